@@ -0,0 +1,444 @@
+#include "cache.h"
+#include "file.h"
+#include "url.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <openssl/evp.h>
+
+#define CACHE_MAGIC 0x45433630
+#define CACHE_VERSION 1
+
+// Number of slots in the index, a url longer than CACHE_URL_SIZE - 1 is
+// never cached
+#define CACHE_ENTRIES 4096
+#define CACHE_URL_SIZE 1024
+
+// A SHA-256 in hex, plus the null terminator
+#define BLOB_NAME_SIZE 65
+
+#define PATH_SIZE 2048
+#define COPY_BUF_SIZE 65536
+
+
+enum {
+    ENTRY_EMPTY = 0,
+    ENTRY_USED,
+    ENTRY_DELETED
+};
+
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t clock;         // Bumped every time an entry is used
+    uint64_t total_size;    // Bytes of blobs stored
+} CacheHeader;
+
+
+typedef struct {
+    uint32_t state;
+    uint32_t hash;          // Hash of the url
+    uint64_t size;
+    uint64_t last_used;     // Value of the clock when last used
+    char url[CACHE_URL_SIZE];
+    char blob[BLOB_NAME_SIZE];
+    Validators validators;
+} CacheEntry;
+
+
+// The layout of the index file, an open addressing hash table of urls
+typedef struct {
+    CacheHeader header;
+    CacheEntry entries[CACHE_ENTRIES];
+} CacheIndex;
+
+
+struct CacheStruct {
+    char dir[PATH_SIZE - BLOB_NAME_SIZE - 8];
+    size_t max_bytes;
+
+    int fd;
+    CacheIndex *index;
+
+    pthread_mutex_t lock;
+};
+
+
+/**
+ * Lock a cache against other threads, and other processes using the same
+ * directory
+ */
+static void lock_cache(Cache *cache) {
+    pthread_mutex_lock(&cache->lock);
+
+    while (flock(cache->fd, LOCK_EX) == -1 && errno == EINTR) {
+    }
+}
+
+
+static void unlock_cache(Cache *cache) {
+    flock(cache->fd, LOCK_UN);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+
+static void blob_path(Cache *cache, const char *blob, char *path) {
+    snprintf(path, PATH_SIZE, "%s/blobs/%s", cache->dir, blob);
+}
+
+
+/**
+ * Find the entry for a url, or when create is set, a free slot for it.
+ * @return The entry, or NULL if there is none (or no free slot)
+ */
+static CacheEntry *find_entry(Cache *cache, const char *url, int create) {
+    uint32_t hash = url_hash(url);
+    CacheEntry *free_slot = NULL;
+
+    if (strlen(url) >= CACHE_URL_SIZE) {
+        return NULL;
+    }
+
+    for (int n = 0, i = hash % CACHE_ENTRIES; n < CACHE_ENTRIES; ++n, i = (i + 1) % CACHE_ENTRIES) {
+        CacheEntry *entry = &cache->index->entries[i];
+
+        if (entry->state == ENTRY_EMPTY) {
+            if (free_slot == NULL) {
+                free_slot = entry;
+            }
+            break;
+        }
+
+        if (entry->state == ENTRY_DELETED) {
+            if (free_slot == NULL) {
+                free_slot = entry;
+            }
+        }
+        else if (entry->hash == hash && strcmp(entry->url, url) == 0) {
+            return entry;
+        }
+    }
+
+    if (!create || free_slot == NULL) {
+        return NULL;
+    }
+
+    memset(free_slot, 0, sizeof(CacheEntry));
+    free_slot->hash = hash;
+    strcpy(free_slot->url, url);
+    return free_slot;
+}
+
+
+/**
+ * Remove an entry, deleting its blob unless another entry shares it.
+ */
+static void remove_entry(Cache *cache, CacheEntry *entry) {
+    char path[PATH_SIZE];
+    int shared = 0;
+
+    entry->state = ENTRY_DELETED;
+
+    for (int i = 0; i < CACHE_ENTRIES && !shared; ++i) {
+        CacheEntry *other = &cache->index->entries[i];
+        shared = other->state == ENTRY_USED && strcmp(other->blob, entry->blob) == 0;
+    }
+
+    if (!shared) {
+        blob_path(cache, entry->blob, path);
+        unlink(path);
+        cache->index->header.total_size -= entry->size;
+    }
+}
+
+
+/**
+ * Remove the least recently used entry other than keep.
+ * @return 0 if an entry was removed, -1 if there was none to remove
+ */
+static int evict_one(Cache *cache, CacheEntry *keep) {
+    CacheEntry *oldest = NULL;
+
+    for (int i = 0; i < CACHE_ENTRIES; ++i) {
+        CacheEntry *entry = &cache->index->entries[i];
+
+        if (entry->state == ENTRY_USED && entry != keep &&
+                (oldest == NULL || entry->last_used < oldest->last_used)) {
+            oldest = entry;
+        }
+    }
+
+    if (oldest == NULL) {
+        return -1;
+    }
+
+    remove_entry(cache, oldest);
+    return 0;
+}
+
+
+/**
+ * Compute the SHA-256 of a file as hex.
+ * @return The size of the file or -1 on failure
+ */
+static off_t hash_file(const char *path, char *blob) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_length = 0;
+    ssize_t n = 0;
+    off_t size = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    char *buf = (char *)malloc(COPY_BUF_SIZE);
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+
+    while ((n = read(fd, buf, COPY_BUF_SIZE)) > 0) {
+        EVP_DigestUpdate(ctx, buf, n);
+        size += n;
+    }
+
+    EVP_DigestFinal_ex(ctx, digest, &digest_length);
+    EVP_MD_CTX_free(ctx);
+    free(buf);
+    close(fd);
+
+    if (n == -1) {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < digest_length; ++i) {
+        snprintf(blob + i * 2, 3, "%02x", digest[i]);
+    }
+
+    return size;
+}
+
+
+/**
+ * Open (creating if needed) a cache in a directory
+ * @param dir - The directory to keep the cache in
+ * @param max_bytes - The maximum total size of the cached blobs
+ * @return cache - Pointer to the cache or NULL on failure
+ */
+Cache *cache_open(const char *dir, size_t max_bytes) {
+    char path[PATH_SIZE];
+    struct stat st;
+
+    snprintf(path, PATH_SIZE, "%s/blobs", dir);
+    if ((mkdir(dir, 0700) == -1 && errno != EEXIST) ||
+            (mkdir(path, 0700) == -1 && errno != EEXIST)) {
+        perror("mkdir");
+        return NULL;
+    }
+
+    snprintf(path, PATH_SIZE, "%s/index", dir);
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd == -1) {
+        perror("open");
+        return NULL;
+    }
+
+    // another process may be creating the index too
+    if (flock(fd, LOCK_EX) == -1) {
+        perror("flock");
+        close(fd);
+        return NULL;
+    }
+
+    // a new (or damaged) index starts out zeroed, i.e. empty
+    if (fstat(fd, &st) == -1 || (st.st_size != sizeof(CacheIndex) &&
+            (ftruncate(fd, 0) == -1 || ftruncate(fd, sizeof(CacheIndex)) == -1))) {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+
+    CacheIndex *index = mmap(NULL, sizeof(CacheIndex), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (index == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return NULL;
+    }
+
+    if (index->header.magic != CACHE_MAGIC || index->header.version != CACHE_VERSION) {
+        memset(index, 0, sizeof(CacheIndex));
+        index->header.magic = CACHE_MAGIC;
+        index->header.version = CACHE_VERSION;
+    }
+
+    flock(fd, LOCK_UN);
+
+    Cache *cache = (Cache *)malloc(sizeof(Cache));
+    snprintf(cache->dir, sizeof(cache->dir), "%s", dir);
+    cache->max_bytes = max_bytes;
+    cache->fd = fd;
+    cache->index = index;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    return cache;
+}
+
+
+/**
+ * Close a cache, leaving it on disk for the next run
+ * @param cache - Pointer to the cache to close
+ */
+void cache_close(Cache *cache) {
+    msync(cache->index, sizeof(CacheIndex), MS_ASYNC);
+    munmap(cache->index, sizeof(CacheIndex));
+    close(cache->fd);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+
+/**
+ * Get the validators of the cached copy of a url
+ * @param cache - Pointer to the cache
+ * @param url - The url to look up
+ * @param validators - Filled with the validators of the cached copy
+ * @return 0 if there is a cached copy, -1 otherwise
+ */
+int cache_lookup(Cache *cache, const char *url, Validators *validators) {
+    char path[PATH_SIZE];
+    int rc = -1;
+
+    lock_cache(cache);
+    CacheEntry *entry = find_entry(cache, url, 0);
+
+    if (entry != NULL) {
+        // the blob may have been removed from under us
+        blob_path(cache, entry->blob, path);
+
+        if (access(path, R_OK) == -1) {
+            remove_entry(cache, entry);
+        }
+        else {
+            *validators = entry->validators;
+            rc = 0;
+        }
+    }
+
+    unlock_cache(cache);
+    return rc;
+}
+
+
+/**
+ * Place the cached copy of a url at a path, reflinking or hardlinking it
+ * when the file system allows and copying it otherwise
+ * @param cache - Pointer to the cache
+ * @param url - The url of the cached copy
+ * @param dest - The path to place it at, replaced if it exists
+ * @return 0 on success, -1 on failure
+ */
+int cache_link(Cache *cache, const char *url, const char *dest) {
+    char path[PATH_SIZE];
+    int rc = -1;
+
+    lock_cache(cache);
+    CacheEntry *entry = find_entry(cache, url, 0);
+
+    if (entry != NULL) {
+        blob_path(cache, entry->blob, path);
+        unlink(dest);
+
+        if (file_clone(path, dest) == 0) {
+            entry->last_used = ++cache->index->header.clock;
+            rc = 0;
+        }
+    }
+
+    unlock_cache(cache);
+    return rc;
+}
+
+
+/**
+ * Store a blob and point the entry for a url at it. The cache must be
+ * locked.
+ * @return 0 on success, -1 on failure
+ */
+static int store_entry(Cache *cache, const char *url, const char *path,
+        const Validators *validators, const char *blob, off_t size) {
+    char dest[PATH_SIZE];
+    CacheEntry *entry = NULL;
+
+    // the blob may already be stored for another url. It is never linked
+    // to the download, so changing the download later leaves it intact.
+    blob_path(cache, blob, dest);
+    if (access(dest, F_OK) == -1) {
+        if (file_reflink(path, dest) == -1) {
+            return -1;
+        }
+        cache->index->header.total_size += size;
+    }
+
+    if ((entry = find_entry(cache, url, 0)) != NULL && strcmp(entry->blob, blob) != 0) {
+        remove_entry(cache, entry);
+        entry = NULL;
+    }
+
+    while (entry == NULL && (entry = find_entry(cache, url, 1)) == NULL) {
+        if (evict_one(cache, NULL) == -1) {
+            return -1;
+        }
+    }
+
+    entry->state = ENTRY_USED;
+    entry->size = size;
+    entry->last_used = ++cache->index->header.clock;
+    entry->validators = *validators;
+    strcpy(entry->blob, blob);
+
+    while (cache->index->header.total_size > cache->max_bytes) {
+        if (evict_one(cache, entry) == -1) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Store a downloaded file as the cached copy of a url
+ * @param cache - Pointer to the cache
+ * @param url - The url the file was downloaded from
+ * @param path - The downloaded file
+ * @param validators - The validators the server sent with the file. Nothing
+ *                     is stored if there are none.
+ * @return 0 on success, -1 on failure
+ */
+int cache_store(Cache *cache, const char *url, const char *path, const Validators *validators) {
+    char blob[BLOB_NAME_SIZE];
+
+    if (validators->etag[0] == '\0' && validators->last_modified[0] == '\0') {
+        return -1;
+    }
+
+    off_t size = hash_file(path, blob);
+    if (size == -1 || size > cache->max_bytes) {
+        return -1;
+    }
+
+    lock_cache(cache);
+    int rc = store_entry(cache, url, path, validators, blob, size);
+    unlock_cache(cache);
+
+    return rc;
+}
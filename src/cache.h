@@ -0,0 +1,71 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+
+#include "http.h"
+
+
+/*
+ * Cache - an on-disk download cache keyed by url. Content is stored in
+ * blobs named by the SHA-256 of their data, so identical content is only
+ * stored once. The index is a fixed size file mapped into memory, so
+ * opening the cache reads nothing up front. Once the blobs exceed the
+ * size cap, the least recently used entries are evicted. A cache may be
+ * shared between threads, and between processes, which take turns through
+ * a lock on the index file. Blobs are copied in (by reflink when the file
+ * system allows) and may be hardlinked out.
+ */
+typedef struct CacheStruct Cache;
+
+
+/**
+ * Open (creating if needed) a cache in a directory
+ * @param dir - The directory to keep the cache in
+ * @param max_bytes - The maximum total size of the cached blobs
+ * @return cache - Pointer to the cache or NULL on failure
+ */
+Cache *cache_open(const char *dir, size_t max_bytes);
+
+
+/**
+ * Close a cache, leaving it on disk for the next run
+ * @param cache - Pointer to the cache to close
+ */
+void cache_close(Cache *cache);
+
+
+/**
+ * Get the validators of the cached copy of a url
+ * @param cache - Pointer to the cache
+ * @param url - The url to look up
+ * @param validators - Filled with the validators of the cached copy
+ * @return 0 if there is a cached copy, -1 otherwise
+ */
+int cache_lookup(Cache *cache, const char *url, Validators *validators);
+
+
+/**
+ * Place the cached copy of a url at a path, reflinking or hardlinking it
+ * when the file system allows and copying it otherwise
+ * @param cache - Pointer to the cache
+ * @param url - The url of the cached copy
+ * @param dest - The path to place it at, replaced if it exists
+ * @return 0 on success, -1 on failure
+ */
+int cache_link(Cache *cache, const char *url, const char *dest);
+
+
+/**
+ * Store a downloaded file as the cached copy of a url
+ * @param cache - Pointer to the cache
+ * @param url - The url the file was downloaded from
+ * @param path - The downloaded file
+ * @param validators - The validators the server sent with the file. Nothing
+ *                     is stored if there are none.
+ * @return 0 on success, -1 on failure
+ */
+int cache_store(Cache *cache, const char *url, const char *path, const Validators *validators);
+
+
+#endif
@@ -0,0 +1,282 @@
+#include "decode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <zlib.h>
+
+#ifdef HAVE_BROTLI
+#include <brotli/decode.h>
+#endif
+
+// Size of the buffer decoded data is passed to the sink in
+#define DECODE_BUF_SIZE 65536
+
+
+typedef enum {
+    CODING_IDENTITY,
+    CODING_ZLIB,
+    CODING_BROTLI
+} Coding;
+
+
+struct DecoderStruct {
+    Coding coding;
+    int finished;       // The end of the encoded stream has been seen
+    int raw_retry;      // deflate may turn out to be raw (no zlib header)
+    long total;
+
+    DecodeSink sink;
+    void *arg;
+
+    z_stream zlib;
+#ifdef HAVE_BROTLI
+    BrotliDecoderState *brotli;
+#endif
+
+    unsigned char out[DECODE_BUF_SIZE];
+};
+
+
+/**
+ * The value for an Accept-Encoding header listing the supported codings
+ * @return string - e.g. "gzip, deflate"
+ */
+const char *decoder_accept_encoding(void) {
+#ifdef HAVE_BROTLI
+    return "gzip, deflate, br";
+#else
+    return "gzip, deflate";
+#endif
+}
+
+
+/**
+ * Check if a header value (which runs to the end of its line) is a
+ * single coding with the given name.
+ */
+static int coding_is(const char *encoding, const char *name) {
+    size_t length = strlen(name);
+
+    if (strncasecmp(encoding, name, length) != 0) {
+        return 0;
+    }
+
+    while (encoding[length] == ' ' || encoding[length] == '\t') {
+        ++length;
+    }
+
+    return encoding[length] == '\0' || encoding[length] == '\r' || encoding[length] == '\n';
+}
+
+
+/**
+ * Allocate a decoder for a content-coding
+ * @param encoding - Value of the Content-Encoding header, NULL for identity
+ * @param sink - Called with each block of decoded data
+ * @param arg - Passed to the sink
+ * @return decoder - Pointer to the decoder or NULL if the coding is not
+ *                   supported
+ */
+Decoder *decoder_alloc(const char *encoding, DecodeSink sink, void *arg) {
+    Decoder *decoder = (Decoder *)malloc(sizeof(Decoder));
+    int rc = Z_OK;
+
+    if (decoder == NULL) {
+        return NULL;
+    }
+
+    memset(&decoder->zlib, 0, sizeof(z_stream));
+    decoder->finished = 0;
+    decoder->raw_retry = 0;
+    decoder->total = 0;
+    decoder->sink = sink;
+    decoder->arg = arg;
+
+    if (encoding == NULL || coding_is(encoding, "identity")) {
+        decoder->coding = CODING_IDENTITY;
+    }
+    else if (coding_is(encoding, "gzip") || coding_is(encoding, "x-gzip")) {
+        decoder->coding = CODING_ZLIB;
+        rc = inflateInit2(&decoder->zlib, MAX_WBITS + 16);
+    }
+    else if (coding_is(encoding, "deflate")) {
+        decoder->coding = CODING_ZLIB;
+        decoder->raw_retry = 1;
+        rc = inflateInit2(&decoder->zlib, MAX_WBITS);
+    }
+#ifdef HAVE_BROTLI
+    else if (coding_is(encoding, "br")) {
+        decoder->coding = CODING_BROTLI;
+        decoder->brotli = BrotliDecoderCreateInstance(NULL, NULL, NULL);
+        rc = decoder->brotli ? Z_OK : Z_MEM_ERROR;
+    }
+#endif
+    else {
+        fprintf(stderr, "unsupported content encoding: %.*s\n",
+                (int)strcspn(encoding, "\r\n"), encoding);
+        free(decoder);
+        return NULL;
+    }
+
+    if (rc != Z_OK) {
+        free(decoder);
+        return NULL;
+    }
+
+    return decoder;
+}
+
+
+/**
+ * Free a decoder
+ * @param decoder - Pointer to the decoder to free
+ */
+void decoder_free(Decoder *decoder) {
+    if (decoder->coding == CODING_ZLIB) {
+        inflateEnd(&decoder->zlib);
+    }
+#ifdef HAVE_BROTLI
+    else if (decoder->coding == CODING_BROTLI) {
+        BrotliDecoderDestroyInstance(decoder->brotli);
+    }
+#endif
+
+    free(decoder);
+}
+
+
+/**
+ * Pass a block of decoded data to the sink.
+ * @return 0 on success, -1 if the sink failed
+ */
+static int decoder_emit(Decoder *decoder, const char *data, size_t length) {
+    if (length == 0) {
+        return 0;
+    }
+
+    decoder->total += length;
+    return decoder->sink(decoder->arg, data, length);
+}
+
+
+static int decoder_write_zlib(Decoder *decoder, const char *data, size_t length) {
+    z_stream *zlib = &decoder->zlib;
+    int rc = Z_OK;
+
+    zlib->next_in = (unsigned char *)data;
+    zlib->avail_in = length;
+
+    do {
+        zlib->next_out = decoder->out;
+        zlib->avail_out = DECODE_BUF_SIZE;
+
+        rc = inflate(zlib, Z_NO_FLUSH);
+
+        // some servers send deflate without the zlib header
+        if (rc == Z_DATA_ERROR && decoder->raw_retry && zlib->total_out == 0) {
+            decoder->raw_retry = 0;
+            inflateReset2(zlib, -MAX_WBITS);
+            zlib->next_in = (unsigned char *)data;
+            zlib->avail_in = length;
+            continue;
+        }
+
+        if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+            fprintf(stderr, "inflate failed: %s\n", zlib->msg ? zlib->msg : "corrupt data");
+            return -1;
+        }
+
+        decoder->raw_retry = 0;
+
+        if (decoder_emit(decoder, (char *)decoder->out, DECODE_BUF_SIZE - zlib->avail_out) == -1) {
+            return -1;
+        }
+
+        if (rc == Z_STREAM_END) {
+            decoder->finished = 1;
+        }
+
+    } while (!decoder->finished && rc != Z_BUF_ERROR &&
+            (zlib->avail_in > 0 || zlib->avail_out == 0));
+
+    return 0;
+}
+
+
+#ifdef HAVE_BROTLI
+static int decoder_write_brotli(Decoder *decoder, const char *data, size_t length) {
+    const uint8_t *next_in = (const uint8_t *)data;
+    size_t avail_in = length;
+    BrotliDecoderResult result;
+
+    do {
+        uint8_t *next_out = decoder->out;
+        size_t avail_out = DECODE_BUF_SIZE;
+
+        result = BrotliDecoderDecompressStream(decoder->brotli, &avail_in, &next_in,
+                &avail_out, &next_out, NULL);
+
+        if (result == BROTLI_DECODER_RESULT_ERROR) {
+            fprintf(stderr, "brotli decoding failed: %s\n",
+                    BrotliDecoderErrorString(BrotliDecoderGetErrorCode(decoder->brotli)));
+            return -1;
+        }
+
+        if (decoder_emit(decoder, (char *)decoder->out, DECODE_BUF_SIZE - avail_out) == -1) {
+            return -1;
+        }
+
+    } while (result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+
+    if (result == BROTLI_DECODER_RESULT_SUCCESS) {
+        decoder->finished = 1;
+    }
+
+    return 0;
+}
+#endif
+
+
+/**
+ * Decode a block of encoded data, passing all the output to the sink
+ * @param decoder - Pointer to the decoder
+ * @param data - Encoded data
+ * @param length - The number of bytes of data
+ * @return 0 on success, -1 if the data is corrupt or the sink failed
+ */
+int decoder_write(Decoder *decoder, const char *data, size_t length) {
+    // anything after the end of the stream is ignored
+    if (length == 0 || decoder->finished) {
+        return 0;
+    }
+
+    switch (decoder->coding) {
+    case CODING_ZLIB:
+        return decoder_write_zlib(decoder, data, length);
+#ifdef HAVE_BROTLI
+    case CODING_BROTLI:
+        return decoder_write_brotli(decoder, data, length);
+#endif
+    default:
+        return decoder_emit(decoder, data, length);
+    }
+}
+
+
+/**
+ * Check that the encoded stream ended cleanly
+ * @param decoder - Pointer to the decoder
+ * @return The number of decoded bytes passed to the sink, or -1 if the
+ *         stream was truncated
+ */
+long decoder_finish(Decoder *decoder) {
+    if (decoder->coding != CODING_IDENTITY && !decoder->finished) {
+        fprintf(stderr, "encoded content was truncated\n");
+        return -1;
+    }
+
+    return decoder->total;
+}
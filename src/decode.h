@@ -0,0 +1,68 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stddef.h>
+
+
+/*
+ * Decoder - incrementally decodes an HTTP content-coding (gzip, deflate and,
+ * when built with brotli, br) into a sink, using bounded buffers.
+ */
+typedef struct DecoderStruct Decoder;
+
+
+/**
+ * Receives decoded data from a decoder.
+ * @param arg - The argument given to decoder_alloc
+ * @param data - Decoded data, only valid for the duration of the call
+ * @param length - The number of bytes of data
+ * @return 0 on success, -1 to stop decoding
+ */
+typedef int (*DecodeSink)(void *arg, const char *data, size_t length);
+
+
+/**
+ * The value for an Accept-Encoding header listing the supported codings
+ * @return string - e.g. "gzip, deflate"
+ */
+const char *decoder_accept_encoding(void);
+
+
+/**
+ * Allocate a decoder for a content-coding
+ * @param encoding - Value of the Content-Encoding header, NULL for identity
+ * @param sink - Called with each block of decoded data
+ * @param arg - Passed to the sink
+ * @return decoder - Pointer to the decoder or NULL if the coding is not
+ *                   supported
+ */
+Decoder *decoder_alloc(const char *encoding, DecodeSink sink, void *arg);
+
+
+/**
+ * Free a decoder
+ * @param decoder - Pointer to the decoder to free
+ */
+void decoder_free(Decoder *decoder);
+
+
+/**
+ * Decode a block of encoded data, passing all the output to the sink
+ * @param decoder - Pointer to the decoder
+ * @param data - Encoded data
+ * @param length - The number of bytes of data
+ * @return 0 on success, -1 if the data is corrupt or the sink failed
+ */
+int decoder_write(Decoder *decoder, const char *data, size_t length);
+
+
+/**
+ * Check that the encoded stream ended cleanly
+ * @param decoder - Pointer to the decoder
+ * @return The number of decoded bytes passed to the sink, or -1 if the
+ *         stream was truncated
+ */
+long decoder_finish(Decoder *decoder);
+
+
+#endif
@@ -1,34 +1,22 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <assert.h>
+#include <ctype.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
-#include <pthread.h>
 
-#include "http.h"
-#include "queue.h"
+#include "libdownloader.h"
+#include "decode.h"
+#include "trace.h"
 
 #define FILE_SIZE 256
 
-typedef struct {
-    char *url;
-    int min_range;
-    int max_range;
-    Buffer *result;
-}  Task;
-
-
-typedef struct {
-    Queue *todo;
-    Queue *done;
-
-    pthread_t *threads;
-    int num_workers;
-
-} Context;
+// Scanned pages of the url list are dropped every this many bytes
+#define READER_RELEASE_BYTES (4 * 1024 * 1024)
 
 void create_directory(const char *dir) {
     struct stat st = { 0 };
@@ -43,223 +31,300 @@ void create_directory(const char *dir) {
 }
 
 
-void *worker_thread(void *arg) {
-    Context *context = (Context *)arg;
-
-    Task *task = (Task *)queue_get(context->todo);
-    char *range = (char *)malloc(1024 * sizeof(char));
-    
-    while (task) {
-        snprintf(range, 1024 * sizeof(char), "%d-%d", task->min_range, 
-        task->max_range);
-    
-        task->result = http_url(task->url, range);
+/**
+ * Get the path a url is saved to in the download directory. Slashes in
+ * the url are replaced so the file lives directly in download_dir.
+ * @param download_dir - The directory downloads are saved in
+ * @param url - The url of the resource
+ * @param length - The length of the url
+ * @param path - Filled with the path, must hold FILE_SIZE chars
+ */
+void get_output_path(const char *download_dir, const char *url, int length, char *path) {
+    snprintf(path, FILE_SIZE, "%s/%.*s", download_dir, length, url);
 
-        queue_put(context->done, task);
-        task = (Task *)queue_get(context->todo);
+    for (int i = strlen(download_dir) + 1; path[i] != '\0'; ++i) {
+        if (path[i] == '/') {
+            path[i] = '|';
+        }
     }
-    
-    free(range);
-    return NULL;
 }
 
 
-Context *spawn_workers(int num_workers) {
-    Context *context = (Context*)malloc(sizeof(Context));
-
-    context->todo = queue_alloc(num_workers * 2);
-    context->done = queue_alloc(num_workers * 2);
+/**
+ * Take the scheduling options out of a line of the url list, e.g.
+ * "http://host/file priority=9" or "http://host/file deadline=500"
+ * @param line - The line, left holding just the url and its mirrors
+ * @param schedule - Filled with the schedule of the line
+ */
+void parse_schedule(char *line, DlSchedule *schedule) {
+    char *out = line, *token = line;
 
-    context->num_workers = num_workers;
+    schedule->priority = DL_PRIORITY_DEFAULT;
+    schedule->deadline_ms = 0;
 
-    context->threads = (pthread_t*)malloc(sizeof(pthread_t) * num_workers);
-    int i = 0;
+    while (*token != '\0') {
+        size_t length = strcspn(token, " \t");
+        char *next = token + length + strspn(token + length, " \t");
 
-    for (i = 0; i < num_workers; ++i) {
-        if (pthread_create(&context->threads[i], NULL, worker_thread, context) != 0) {
-            perror("pthread_create");
-            exit(1);
+        if (strncmp(token, "priority=", 9) == 0) {
+            schedule->priority = atoi(token + 9);
         }
-    }
-
-    return context;
-}
-
-void free_workers(Context *context) {
-    int num_workers = context->num_workers;
-    int i = 0;
-
-    for (i = 0; i < num_workers; ++i) {
-        queue_put(context->todo, NULL);
-    }
-
-    for (i = 0; i < num_workers; ++i) {
-        if (pthread_join(context->threads[i], NULL) != 0) {
-            perror("pthread_join");
-            exit(1);
+        else if (strncmp(token, "deadline=", 9) == 0) {
+            schedule->deadline_ms = atoi(token + 9);
+        }
+        else {
+            if (out != line) {
+                *out++ = ' ';
+            }
+            memmove(out, token, length);
+            out += length;
         }
-    }
 
-    queue_free(context->todo);
-    queue_free(context->done);
+        token = next;
+    }
 
-    free(context->threads);
-    free(context);
+    *out = '\0';
 }
 
 
-Task *new_task(char *url, int min_range, int max_range) {
-    Task *task = malloc(sizeof(Task));
-    task->result = NULL;
-    task->url = malloc(strlen(url) + 1);
-    task->min_range = min_range;
-    task->max_range = max_range;
-
-    strcpy(task->url, url);
+/**
+ * Report a download once it is done, counting it in *arg if it failed.
+ * Called by the engine, from several threads at once.
+ */
+void report_download(DlDownload *download, int status, void *arg) {
+    const char *url = dl_url(download);
+    DlResult result;
 
-    return task;
-}
+    dl_result(download, &result);
 
-void free_task(Task *task) {
+    if (status != 0) {
+        fprintf(stderr, "failed to download %s\n", url);
+        __atomic_add_fetch((int *)arg, 1, __ATOMIC_RELAXED);
+    }
+    else if (result.source == DL_SOURCE_DUPLICATE) {
+        printf("duplicate url, sharing download of %s\n", url);
+    }
+    else if (result.source == DL_SOURCE_CACHE) {
+        printf("not modified, using cached copy of %s\n", url);
+    }
+    else {
+        printf("downloaded %lld bytes in %d chunks from %s\n", (long long)result.bytes,
+                result.chunks, url);
+    }
 
-    if (task->result) {
-        free(task->result->data);
-        free(task->result);
+    if (result.failed_chunks > 0) {
+        fprintf(stderr, "%d chunks of %s failed\n", result.failed_chunks, url);
     }
 
-    free(task->url);
-    free(task);
-}
+    for (int i = 0; i < result.num_mirrors; ++i) {
+        DlMirrorResult *m = &result.mirrors[i];
 
+        printf("mirror %s: %d chunks, %lu bytes, %.1f MiB/s%s\n", m->url, m->chunks,
+                (unsigned long)m->bytes, m->rate / (1024 * 1024), m->dropped ? " (dropped)" : "");
+    }
 
-void wait_task(const char *download_dir, Context *context) {
-    char filename[FILE_SIZE], url_file[FILE_SIZE];
-    Task *task = (Task*)queue_get(context->done);
+    if (result.late_ms > 0) {
+        fprintf(stderr, "missed deadline by %ld ms: %s\n", result.late_ms, url);
+    }
+}
 
-    if (task->result) {
 
-        snprintf(url_file, FILE_SIZE * sizeof(char), "%d", task->min_range);
-        size_t len = strlen(url_file);
-        for (int i = 0; i < len; ++i) {
-            if (url_file[i] == '/') {
-                url_file[i] = '|';
-            }
+/**
+ * Submit every line of a url list to the engine. The list is mapped and
+ * scanned a line at a time, and the engine's bounded planning queue holds
+ * back reading, so lists far larger than memory are fine.
+ * @param engine - The engine to download with
+ * @param url_file - The file with one url (and any mirrors) per line,
+ *                   optionally with a priority= or deadline= in ms
+ * @param download_dir - The directory downloads are saved in
+ * @param failures - Counts the downloads that fail
+ * @return 0 on success, -1 if the file could not be read
+ */
+int submit_url_file(DlEngine *engine, const char *url_file, const char *download_dir, int *failures) {
+    char output_path[FILE_SIZE];
+    DlSchedule schedule;
+    struct stat st;
+
+    int fd = open(url_file, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror(url_file);
+        if (fd != -1) {
+            close(fd);
         }
+        return -1;
+    }
 
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
 
-        snprintf(filename, FILE_SIZE, "%s/%s", download_dir, url_file);
-        FILE *fp = fopen(filename, "w");
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return -1;
+    }
 
-        if (fp == NULL) {
-            fprintf(stderr, "error writing to: %s\n", filename);
-            exit(EXIT_FAILURE);
-        }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
 
-        char *data = http_get_content(task->result);
-        if (data) {
-            size_t length = task->result->length - (data - task->result->data);
+    const char *end = data + st.st_size, *p = data;
+    size_t page = sysconf(_SC_PAGESIZE), released = 0;
+    char *line = NULL;
 
-            fwrite(data, 1, length, fp);
-            fclose(fp);
+    while (p < end) {
+        // memchr scans a vector of bytes at a time
+        const char *newline = memchr(p, '\n', end - p);
+        const char *line_end = newline ? newline : end;
 
-            printf("downloaded %d bytes from %s\n", (int)length, task->url);
+        while (p < line_end && isspace((unsigned char)*p)) {
+            ++p;
         }
-        else {
-            printf("error in response from %s\n", task->url);
+        while (line_end > p && isspace((unsigned char)line_end[-1])) {
+            --line_end;
         }
 
-    }
-    else {
+        if (line_end > p) {
+            line = strndup(p, line_end - p);
+            parse_schedule(line, &schedule);
+            get_output_path(download_dir, line, strcspn(line, " \t"), output_path);
 
-        fprintf(stderr, "error downloading: %s\n", task->url);
+            dl_download_free(dl_submit(engine, line, output_path, &schedule, report_download, failures));
+            free(line);
+        }
 
-    }
-
-    free_task(task);
-}
+        p = newline ? newline + 1 : end;
 
+        // the list may be far larger than memory, so drop what has been read
+        if ((size_t)(p - data) - released >= READER_RELEASE_BYTES) {
+            size_t upto = (p - data) / page * page;
+            madvise(data + released, upto - released, MADV_DONTNEED);
+            released = upto;
+        }
+    }
 
-/**
- * Merge all files in from src to file with name dest synchronously
- * by reading each file, and writing its contents to the dest file.
- * @param src - char pointer to src directory holding files to merge
- * @param dest - char pointer to name of file resulting from merge
- * @param bytes - The maximum byte size downloaded
- * @param tasks - The tasks needed for the multipart download
- */
-void merge_files(char *src, char *dest, int bytes, int tasks) {
-    assert(0 && "not implemented yet!");
+    munmap(data, st.st_size);
+    close(fd);
+    return 0;
 }
 
 
-/**
- * Remove files caused by chunk downloading
- * @param dir - The directory holding the chunked files
- * @param bytes - The maximum byte size per file. Assumed to be filename
- * @param files - The number of chunked files to remove.
- */
-void remove_chunk_files(char *dir, int bytes, int files) {
-   assert(0 && "not implemented yet!");
+void usage(const DlConfig *defaults) {
+    fprintf(stderr, "usage: ./downloader [-p planners] [-j active] [-f first_kb] [-a] [-k stack_kb] [-z] [-c cache_dir [-s cache_mb]] [-d] [-m | -w writers [-b budget_mb]] [-t trace_file] url_file num_workers download_dir\n");
+    fprintf(stderr, "  -p  number of threads planning urls ahead of the downloads (default %d)\n", defaults->num_planners);
+    fprintf(stderr, "  -j  number of urls downloaded at once (default %d)\n", defaults->max_active);
+    fprintf(stderr, "  -f  KiB requested speculatively to plan each url, 0 to plan with HEAD (default %d)\n", defaults->first_size / 1024);
+    fprintf(stderr, "  -a  pin each worker and writer thread to one of the cpus the process may use\n");
+    fprintf(stderr, "  -k  stack size of each thread in KiB, at least %d (default: the system default)\n", THREAD_MIN_STACK / 1024);
+    fprintf(stderr, "  -z  accept compressed content (%s), decoded as it arrives\n", decoder_accept_encoding());
+    fprintf(stderr, "  -c  keep a download cache here, revalidated on later runs\n");
+    fprintf(stderr, "  -s  size cap of the download cache in MiB (default %d)\n", (int)(defaults->cache_size >> 20));
+    fprintf(stderr, "  -d  have each worker write its chunks in place, the last one finalizing the file\n");
+    fprintf(stderr, "  -m  read content straight into a memory mapped output file\n");
+    fprintf(stderr, "  -w  write chunks from a separate stage with this many threads\n");
+    fprintf(stderr, "  -b  memory budget of the writer stage in MiB (default %d)\n", (int)(defaults->writer_budget >> 20));
+    fprintf(stderr, "  -t  trace every request and save it here, for chrome://tracing or Perfetto\n");
+    fprintf(stderr, "each line of url_file is a url, any mirrors of it, and optionally priority=%d..%d (default %d)\n",
+            DL_PRIORITY_MIN, DL_PRIORITY_MAX, DL_PRIORITY_DEFAULT);
+    fprintf(stderr, "or deadline=ms to have it wanted that soon after it is read\n");
+    exit(1);
 }
 
 
 int main(int argc, char **argv) {
-    if (argc != 4) {
-        fprintf(stderr, "usage: ./downloader url_file num_workers download_dir\n");
-        exit(1);
+    DlConfig config, defaults;
+    int opt = 0, first_kb = 0, stack_kb = 0, cache_mb = 0, budget_mb = 0, failures = 0;
+    const char *trace_file = NULL;
+
+    dl_config_init(&defaults);
+    config = defaults;
+    config.dedup = 1;
+
+    first_kb = defaults.first_size / 1024;
+    cache_mb = defaults.cache_size >> 20;
+    budget_mb = defaults.writer_budget >> 20;
+
+    while ((opt = getopt(argc, argv, "p:j:f:ak:zc:s:dmw:b:t:")) != -1) {
+        switch (opt) {
+        case 'p':
+            config.num_planners = atoi(optarg);
+            break;
+        case 'j':
+            config.max_active = atoi(optarg);
+            break;
+        case 'f':
+            first_kb = atoi(optarg);
+            break;
+        case 'a':
+            config.threads.pin = 1;
+            break;
+        case 'k':
+            stack_kb = atoi(optarg);
+            break;
+        case 'c':
+            config.cache_dir = optarg;
+            break;
+        case 's':
+            cache_mb = atoi(optarg);
+            break;
+        case 'z':
+            config.decode = 1;
+            break;
+        case 'd':
+            config.direct = 1;
+            break;
+        case 'm':
+            config.use_mmap = 1;
+            break;
+        case 'w':
+            config.num_writers = atoi(optarg);
+            break;
+        case 'b':
+            budget_mb = atoi(optarg);
+            break;
+        case 't':
+            trace_file = optarg;
+            break;
+        default:
+            usage(&defaults);
+        }
     }
 
-    char *url_file = argv[1];
-    int num_workers = atoi(argv[2]);
-    char *download_dir = argv[3];
+    if (argc - optind != 3 || config.num_writers < 0 || budget_mb <= 0 || cache_mb <= 0 ||
+            config.num_planners <= 0 || config.max_active <= 0 || first_kb < 0 || stack_kb < 0 ||
+            ((config.use_mmap || config.direct) && config.num_writers > 0)) {
+        usage(&defaults);
+    }
+
+    char *url_file = argv[optind];
+    char *download_dir = argv[optind + 2];
+
+    config.num_workers = atoi(argv[optind + 1]);
+    config.first_size = first_kb * 1024;
+    config.cache_size = (size_t)cache_mb * 1024 * 1024;
+    config.writer_budget = (size_t)budget_mb * 1024 * 1024;
+    config.threads.stack_size = (size_t)stack_kb * 1024;
 
     create_directory(download_dir);
-    FILE *fp = fopen(url_file, "r");
-    char *line = NULL;
-    size_t len = 0;
 
-    if (fp == NULL) {
+    if (trace_file && trace_enable() == -1) {
+        fprintf(stderr, "tracing was compiled out, not writing %s\n", trace_file);
+        trace_file = NULL;
+    }
+
+    DlEngine *engine = dl_engine_create(&config);
+    if (engine == NULL) {
         exit(EXIT_FAILURE);
     }
 
-    // spawn threads and create work queue(s)
-    Context *context = spawn_workers(num_workers);
+    int rc = submit_url_file(engine, url_file, download_dir, &failures);
 
-    int work = 0, bytes = 0, num_tasks = 0;
-    while ((len = getline(&line, &len, fp)) != -1) {
+    // waits for every download
+    dl_engine_free(engine);
 
-        if (line[len - 1] == '\n') {
-            line[len - 1] = '\0';
-        }
-
-        num_tasks = get_num_tasks(line, num_workers);
-        bytes = get_max_chunk_size();
-        
-        for (int i  = 0; i < num_tasks; i ++) {
-            ++work;
-            queue_put(context->todo, new_task(line, i * bytes, (i+1) * bytes));
-        }
-      
-        // Get results back
-        while (work > 0) {
-            --work;
-            wait_task(download_dir, context);
-        }
-        
-        /* Merge the files -- simple synchronous method
-         * Then remove the chunked download files
-         * Beware, this is not an efficient method
-         */
-        merge_files(download_dir, line, bytes, num_tasks);
-        remove_chunk_files(download_dir, bytes, num_tasks);
+    if (trace_file && trace_dump(trace_file) == -1) {
+        perror(trace_file);
     }
-   
-
-    //cleanup
-    fclose(fp);
-    free(line);
 
-    free_workers(context);
-
-    return 0;
+    return rc == 0 && failures == 0 ? 0 : EXIT_FAILURE;
 }
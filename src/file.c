@@ -0,0 +1,106 @@
+#include "file.h"
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#define COPY_BUF_SIZE 65536
+
+
+/**
+ * Copy a file, replacing dest
+ * @param src - The file to copy
+ * @param dest - The path to copy it to
+ * @return 0 on success, -1 on failure
+ */
+int file_copy(const char *src, const char *dest) {
+    char *buf = NULL;
+    ssize_t n = 0;
+    int rc = 0;
+
+    int in = open(src, O_RDONLY);
+    if (in == -1) {
+        return -1;
+    }
+
+    int out = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out == -1) {
+        close(in);
+        return -1;
+    }
+
+    buf = (char *)malloc(COPY_BUF_SIZE);
+
+    while (rc == 0 && (n = read(in, buf, COPY_BUF_SIZE)) > 0) {
+        rc = write(out, buf, n) == n ? 0 : -1;
+    }
+
+    free(buf);
+    close(in);
+    close(out);
+    return rc == 0 && n == 0 ? 0 : -1;
+}
+
+
+/**
+ * Reflink src to dest, which must not exist, leaving no dest behind if
+ * the file system cannot.
+ * @return 0 on success, -1 on failure
+ */
+static int try_reflink(const char *src, const char *dest) {
+    int rc = -1;
+
+    int in = open(src, O_RDONLY);
+    if (in == -1) {
+        return -1;
+    }
+
+    int out = open(dest, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (out != -1) {
+        rc = ioctl(out, FICLONE, in);
+        close(out);
+
+        if (rc != 0) {
+            unlink(dest);
+        }
+    }
+
+    close(in);
+    return rc == 0 ? 0 : -1;
+}
+
+
+/**
+ * Give dest its own copy of src, which must not exist: a copy-on-write
+ * reflink when the file system allows, otherwise a plain copy. Unlike
+ * file_clone, changing one file never changes the other.
+ * @param src - The file to copy
+ * @param dest - The path to copy it to
+ * @return 0 on success, -1 on failure
+ */
+int file_reflink(const char *src, const char *dest) {
+    if (try_reflink(src, dest) == 0) {
+        return 0;
+    }
+
+    return file_copy(src, dest);
+}
+
+
+/**
+ * Share the data of src at dest, which must not exist. A reflink gives dest
+ * its own copy-on-write copy; failing that dest is hardlinked to src, and
+ * failing that the data is copied.
+ * @param src - The file to share
+ * @param dest - The path to share it at
+ * @return 0 on success, -1 on failure
+ */
+int file_clone(const char *src, const char *dest) {
+    if (try_reflink(src, dest) == 0 || link(src, dest) == 0) {
+        return 0;
+    }
+
+    return file_copy(src, dest);
+}
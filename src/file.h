@@ -0,0 +1,36 @@
+#ifndef FILE_H
+#define FILE_H
+
+
+/**
+ * Copy a file, replacing dest
+ * @param src - The file to copy
+ * @param dest - The path to copy it to
+ * @return 0 on success, -1 on failure
+ */
+int file_copy(const char *src, const char *dest);
+
+
+/**
+ * Give dest its own copy of src, which must not exist: a copy-on-write
+ * reflink when the file system allows, otherwise a plain copy. Unlike
+ * file_clone, changing one file never changes the other.
+ * @param src - The file to copy
+ * @param dest - The path to copy it to
+ * @return 0 on success, -1 on failure
+ */
+int file_reflink(const char *src, const char *dest);
+
+
+/**
+ * Share the data of src at dest, which must not exist. A reflink gives dest
+ * its own copy-on-write copy; failing that dest is hardlinked to src, and
+ * failing that the data is copied.
+ * @param src - The file to share
+ * @param dest - The path to share it at
+ * @return 0 on success, -1 on failure
+ */
+int file_clone(const char *src, const char *dest);
+
+
+#endif
@@ -6,12 +6,66 @@
 #include <netdb.h>
 #include <string.h>
 #include <unistd.h>
+#include <strings.h>
 #include <assert.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "http.h"
+#include "decode.h"
+#include "trace.h"
 
 #define BUF_SIZE 1024
 
+// Size of the blocks streamed responses are read in
+#define STREAM_BUF_SIZE 65536
+
+// The most fragments a request is assembled from
+#define REQUEST_FRAGMENTS 16
+
+// The most fragments one writev takes, when limits.h does not say
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// Receive buffer asked for on each connection. Setting it turns off the
+// kernel's autotuning, so it is sized for a fast link with a long round trip.
+#define SOCKET_RCVBUF_SIZE (4 * 1024 * 1024)
+
+// How long a resolved host is reused before it is looked up again
+#define DNS_CACHE_TTL_MS 60000
+
+// The most hosts whose addresses are kept, and the longest host kept
+#define DNS_CACHE_SIZE 64
+#define DNS_HOST_SIZE 256
+
+// The rest of the request line, up to the host
+#define HTTP_1_0 " HTTP/1.0\r\nHost: "
+#define HTTP_1_1 " HTTP/1.1\r\nHost: "
+
+off_t max_chunk_size;
+off_t content_length;
+
+// Whether unranged requests ask the server to compress the content
+static bool accept_encoding = false;
+
+// An address a host resolved to, shared by every connection to it
+typedef struct
+{
+    char host[DNS_HOST_SIZE];   // Empty for a free entry
+    int port;
+    struct sockaddr_storage addr;
+    socklen_t addr_length;
+    long expires;               // In ms on the monotonic clock
+} DnsEntry;
+
+static DnsEntry dns_cache[DNS_CACHE_SIZE];
+static pthread_mutex_t dns_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /**
  * Creates a buffer with size t_initial_size bytes.
  * Returns a pointer to the buffer or NULL upon failure.
@@ -47,8 +101,6 @@ int buffer_double_size(Buffer *t_buffer)
     size_t new_length = t_buffer->length * 2;
     char *new_data = realloc(t_buffer->data, new_length);
 
-    printf("Realloc'ing from %lu to %lu...\n", t_buffer->length, new_length);
-
     if (new_data != NULL)
     {
         t_buffer->data = new_data;
@@ -67,86 +119,270 @@ int buffer_double_size(Buffer *t_buffer)
 }
 
 /**
- * Allocates memory for a null-terminated string containing the request. The
- * string must be freed manually.
- * Returns NULL upon failure.
+ * Appends a string to a request being assembled in t_iov, skipping empty
+ * strings. The string is referenced, not copied.
+ * Returns the new number of fragments.
  */
-Buffer *util_create_request(const char *t_host, const char *t_path)
+int util_add_fragment(struct iovec *t_iov, int t_count, const char *t_data)
 {
-    // "GET" + " " + $PATH + " " + "HTTP/1.0" + "\r\n" + "\r\n" + "\0"
-    size_t length = 3 + 1 + strlen(t_path) + 1 + 8 + 2 + 6 + strlen(t_host) + 2 + 2 + 1;
-    Buffer *buffer = buffer_create(length);
+    size_t length = t_data != NULL ? strlen(t_data) : 0;
 
-    if (buffer != NULL)
+    if (length > 0)
     {
-        snprintf(buffer->data, length, "GET %s HTTP/1.0\r\nHost: %s\r\n\r\n", t_path, t_host);
+        t_iov[t_count].iov_base = (void *)t_data;
+        t_iov[t_count].iov_len = length;
+        ++t_count;
     }
 
-    return buffer;
+    return t_count;
 }
 
 /**
- * Creates and returns a client socket. Based on https://gist.github.com/browny/5211329
- * Returns -1 upon failure.
+ * Assembles a request in t_iov from static fragments and the strings of
+ * this request, so nothing is formatted or copied. t_iov must hold
+ * REQUEST_FRAGMENTS entries. A Range header is only added when t_range is
+ * not empty. Ranges always ask for the identity coding, so an
+ * Accept-Encoding header is only added to unranged requests. t_headers holds
+ * any further header lines, each ending in "\r\n", or is NULL. t_version is
+ * the rest of the request line up to the host, e.g. HTTP_1_0.
+ * Returns the number of fragments used.
  */
-int util_create_socket(const char *t_host, int t_port)
+int util_create_request(struct iovec *t_iov, const char *t_method, const char *t_host, const char *t_path,
+                        const char *t_range, const char *t_headers, const char *t_version)
 {
-    int sockfd = 0;
+    int count = 0;
 
-    // attempt to create the socket
-    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) >= 0)
+    // $METHOD + " /" + $PATH + " HTTP/1.x\r\nHost: " + $HOST + "\r\n"
+    count = util_add_fragment(t_iov, count, t_method);
+    count = util_add_fragment(t_iov, count, " /");
+    count = util_add_fragment(t_iov, count, t_path);
+    count = util_add_fragment(t_iov, count, t_version);
+    count = util_add_fragment(t_iov, count, t_host);
+    count = util_add_fragment(t_iov, count, "\r\n");
+
+    if (t_range != NULL && t_range[0] != '\0')
+    {
+        // "Range: bytes=" + $RANGE + "\r\n"
+        count = util_add_fragment(t_iov, count, "Range: bytes=");
+        count = util_add_fragment(t_iov, count, t_range);
+        count = util_add_fragment(t_iov, count, "\r\n");
+    }
+    else if (accept_encoding)
+    {
+        // "Accept-Encoding: " + $ENCODINGS + "\r\n"
+        count = util_add_fragment(t_iov, count, "Accept-Encoding: ");
+        count = util_add_fragment(t_iov, count, decoder_accept_encoding());
+        count = util_add_fragment(t_iov, count, "\r\n");
+    }
+
+    // $HEADERS + "\r\n"
+    count = util_add_fragment(t_iov, count, t_headers);
+    count = util_add_fragment(t_iov, count, "\r\n");
+
+    return count;
+}
+
+/**
+ * Sets an integer socket option, reporting but otherwise ignoring failure
+ * since every option set here is only a tuning.
+ */
+void util_set_socket_option(int t_socket, int t_level, int t_option, int t_value, const char *t_name)
+{
+    if (setsockopt(t_socket, t_level, t_option, &t_value, sizeof(t_value)) == -1)
+    {
+        perror(t_name);
+    }
+}
+
+/**
+ * Asks the kernel to acknowledge received data at once instead of delaying
+ * the ACK. The kernel may fall back to delayed ACKs, so this is repeated
+ * before each response is read.
+ */
+void util_quick_ack(int t_socket)
+{
+#ifdef TCP_QUICKACK
+    util_set_socket_option(t_socket, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+#endif
+}
+
+/**
+ * Returns the monotonic clock in ms.
+ */
+long util_now_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000;
+}
+
+/**
+ * Resolves a host to the address to connect to. Addresses are cached for
+ * DNS_CACHE_TTL_MS, so a download split into many requests looks its host
+ * up once rather than once per request. When the cache is full the entry
+ * closest to expiring is replaced.
+ * Returns 0 on success, -1 if the host could not be resolved.
+ */
+int util_resolve(const char *t_host, int t_port, struct sockaddr_storage *t_addr, socklen_t *t_length)
+{
+    struct addrinfo hints;
+    struct addrinfo *serv_addr = NULL;
+    char port_str[20], name[DNS_HOST_SIZE];
+    long now = util_now_ms();
+    int i = 0, slot = 0, rc = 0;
+
+    pthread_mutex_lock(&dns_lock);
+
+    for (i = 0; i < DNS_CACHE_SIZE; ++i)
     {
-        struct addrinfo hints;
-        struct addrinfo *serv_addr = NULL;
-        char port_str[20];
-        int n;
+        DnsEntry *entry = &dns_cache[i];
 
-        n = snprintf(port_str, 20, "%d", t_port);
-        if ((n < 0) || (n >= 20))
+        if (entry->port == t_port && entry->expires > now && strcmp(entry->host, t_host) == 0)
         {
-            fprintf(stderr, "Could not convert port\n");
-            return -1;
+            memcpy(t_addr, &entry->addr, entry->addr_length);
+            *t_length = entry->addr_length;
+            pthread_mutex_unlock(&dns_lock);
+            return 0;
         }
+    }
+
+    pthread_mutex_unlock(&dns_lock);
+
+    snprintf(port_str, 20, "%d", t_port);
+
+    // a host split from a url may still carry its port for the Host header
+    strncpy(name, t_host, DNS_HOST_SIZE - 1);
+    name[DNS_HOST_SIZE - 1] = '\0';
+    name[strcspn(name, ":")] = '\0';
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    long start = trace_now();
+
+    rc = getaddrinfo(name, port_str, &hints, &serv_addr);
+    trace_span("dns", start);
+
+    if (rc != 0)
+    {
+        fprintf(stderr, "Couldn't get addrinfo for %s: %s\n", t_host, gai_strerror(rc));
+        return -1;
+    }
+
+    memcpy(t_addr, serv_addr->ai_addr, serv_addr->ai_addrlen);
+    *t_length = serv_addr->ai_addrlen;
+    freeaddrinfo(serv_addr);
 
-        memset(&hints, 0, sizeof(struct addrinfo));
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_STREAM;
+    // hosts too long to keep are simply looked up each time
+    if (strlen(t_host) >= DNS_HOST_SIZE)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&dns_lock);
 
-        if (getaddrinfo(t_host, port_str, &hints, &serv_addr) != 0)
+    for (i = 0; i < DNS_CACHE_SIZE; ++i)
+    {
+        if (dns_cache[i].port == t_port && strcmp(dns_cache[i].host, t_host) == 0)
         {
-            fprintf(stderr, "Couldn't get addrinfo from inet_pton or getaddrinfo\n");
-        };
+            slot = i;
+            break;
+        }
 
-        if (connect(sockfd, serv_addr->ai_addr, serv_addr->ai_addrlen) >= 0)
+        if (dns_cache[i].expires < dns_cache[slot].expires)
         {
-            return sockfd;
+            slot = i;
         }
-        else
+    }
+
+    strcpy(dns_cache[slot].host, t_host);
+    dns_cache[slot].port = t_port;
+    memcpy(&dns_cache[slot].addr, t_addr, *t_length);
+    dns_cache[slot].addr_length = *t_length;
+    dns_cache[slot].expires = now + DNS_CACHE_TTL_MS;
+
+    pthread_mutex_unlock(&dns_lock);
+    return 0;
+}
+
+/**
+ * Drops the cached address of a host, e.g. once connecting to it failed,
+ * so the next connection looks it up again.
+ */
+void util_forget_host(const char *t_host, int t_port)
+{
+    pthread_mutex_lock(&dns_lock);
+
+    for (int i = 0; i < DNS_CACHE_SIZE; ++i)
+    {
+        if (dns_cache[i].port == t_port && strcmp(dns_cache[i].host, t_host) == 0)
         {
-            fprintf(stderr, "Could not convert IP address to binary form\n");
+            dns_cache[i].host[0] = '\0';
+            dns_cache[i].expires = 0;
         }
     }
-    else
+
+    pthread_mutex_unlock(&dns_lock);
+}
+
+/**
+ * Creates and returns a client socket. Based on https://gist.github.com/browny/5211329
+ * Nagle's algorithm is turned off so requests leave at once, and the
+ * receive buffer is enlarged before connecting so a large window is offered
+ * from the handshake on. The host is resolved through the address cache.
+ * Returns -1 upon failure.
+ */
+int util_create_socket(const char *t_host, int t_port)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_length = 0;
+    int sockfd = 0;
+
+    if (util_resolve(t_host, t_port, &addr, &addr_length) == -1)
+    {
+        return -1;
+    }
+
+    // attempt to create the socket
+    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
     {
         fprintf(stderr, "Could not create TCP/IP socket\n");
+        return -1;
+    }
+
+    util_set_socket_option(sockfd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    util_set_socket_option(sockfd, SOL_SOCKET, SO_RCVBUF, SOCKET_RCVBUF_SIZE, "SO_RCVBUF");
+
+    long start = trace_now();
+
+    if (connect(sockfd, (struct sockaddr *)&addr, addr_length) < 0)
+    {
+        fprintf(stderr, "Could not connect to %s:%d\n", t_host, t_port);
+        util_forget_host(t_host, t_port);
+        close(sockfd);
+        return -1;
     }
 
-    return -1;
+    trace_span("connect", start);
+
+    util_quick_ack(sockfd);
+    return sockfd;
 }
 
 /**
- * Writes an entire buffer to the socket.
+ * Writes all the fragments to the socket with as few system calls as the
+ * socket allows, resuming after a partial write. t_iov is consumed.
  * Returns the number of bytes written or -1 upon failure.
  */
-int util_write_buffer_to_socket(const Buffer *t_buffer, int t_socket)
+ssize_t util_write_request_to_socket(struct iovec *t_iov, int t_count, int t_socket)
 {
-    size_t data_written = 0;
-    while (data_written < t_buffer->length)
+    ssize_t data_written = 0;
+
+    while (t_count > 0)
     {
-        size_t written_this_iteration = 0;
-        written_this_iteration += write(t_socket,
-                                        t_buffer->data + data_written,
-                                        t_buffer->length - data_written);
+        ssize_t written_this_iteration = writev(t_socket, t_iov, t_count > IOV_MAX ? IOV_MAX : t_count);
 
         // check for errors
         if (written_this_iteration == -1)
@@ -155,6 +391,20 @@ int util_write_buffer_to_socket(const Buffer *t_buffer, int t_socket)
         }
 
         data_written += written_this_iteration;
+
+        // skip the fragments that were sent in full
+        while (t_count > 0 && (size_t)written_this_iteration >= t_iov->iov_len)
+        {
+            written_this_iteration -= t_iov->iov_len;
+            ++t_iov;
+            --t_count;
+        }
+
+        if (t_count > 0)
+        {
+            t_iov->iov_base = (char *)t_iov->iov_base + written_this_iteration;
+            t_iov->iov_len -= written_this_iteration;
+        }
     }
 
     return data_written;
@@ -162,18 +412,22 @@ int util_write_buffer_to_socket(const Buffer *t_buffer, int t_socket)
 
 /**
  * Reads the socket, storing its contents inside the buffer. The buffer will be
- * reallocated until all the data is read.
- * Returns 0 on success or -1 upon failure.
+ * reallocated until all the data is read. The data is null-terminated and the
+ * length of the buffer is set to the number of bytes read.
+ * Returns the number of bytes read or -1 upon failure.
  */
-int util_read_buffer_from_socket(Buffer *t_buffer, int t_socket)
+ssize_t util_read_buffer_from_socket(Buffer *t_buffer, int t_socket)
 {
-    size_t data_read = 0, data_read_this_iteration;
+    size_t data_read = 0;
+    ssize_t data_read_this_iteration;
+    long start = trace_now();
 
     while (true)
     {
+        // always leave space for the null terminator
         data_read_this_iteration = read(t_socket,
-                                        t_buffer->data,
-                                        t_buffer->length - data_read);
+                                        t_buffer->data + data_read,
+                                        t_buffer->length - data_read - 1);
 
         // check if an error occurred
         if (data_read_this_iteration == -1)
@@ -184,14 +438,25 @@ int util_read_buffer_from_socket(Buffer *t_buffer, int t_socket)
         // check if we are finished reading data
         if (data_read_this_iteration == 0)
         {
+            trace_span("transfer", start);
+
+            t_buffer->data[data_read] = '\0';
+            t_buffer->length = data_read;
             return data_read;
         }
 
+        // the wait for the first byte is timed apart from the transfer
+        if (data_read == 0)
+        {
+            trace_span("ttfb", start);
+            start = trace_now();
+        }
+
         // we have more data to read
         data_read += data_read_this_iteration;
 
         // check if we need to reallocate more space for the response
-        if (t_buffer->length - data_read == 0)
+        if (t_buffer->length - data_read == 1)
         {
 
             // allocate more space and check for errors
@@ -207,143 +472,1081 @@ int util_read_buffer_from_socket(Buffer *t_buffer, int t_socket)
 }
 
 /**
- * Perform an HTTP 1.0 query to a given host and page and port number.
- * host is a hostname and page is a path on the remote server. The query
- * will attempt to retrievev content in the given byte range.
- * User is responsible for freeing the memory.
- * 
- * @param host - The host name e.g. www.canterbury.ac.nz
- * @param page - e.g. /index.html
- * @param range - Byte range e.g. 0-500. NOTE: A server may not respect this
- * @param port - e.g. 80
- * @return Buffer - Pointer to a buffer holding response data from query
- *                  NULL is returned on failure.
+ * Reads the socket until the end of the response header has been received.
+ * Any content received with the header is left in the buffer after the
+ * header. The data is null-terminated and the length of the buffer is set to
+ * the number of bytes read.
+ * Returns the length of the header (including the blank line) or -1 upon
+ * failure.
  */
-Buffer *http_query(char *host, char *page, const char *range, int port)
+int util_read_header_from_socket(Buffer *t_buffer, int t_socket)
 {
-    Buffer *res_buf = NULL, *req_buf = NULL;
-    int socket = 0;
+    size_t data_read = 0;
+    ssize_t data_read_this_iteration;
+    char *header_end = NULL;
+    long start = trace_now();
 
-    // attempt to create the response buffer
-    if ((res_buf = buffer_create(BUF_SIZE)) == NULL)
+    t_buffer->data[0] = '\0';
+
+    while ((header_end = strstr(t_buffer->data, "\r\n\r\n")) == NULL)
     {
-        fprintf(stderr, "Could not create res_buf\n");
-        return NULL;
+        // check if we need to reallocate more space for the header
+        if (t_buffer->length - data_read == 1 && buffer_double_size(t_buffer) == -1)
+        {
+            return -1;
+        }
+
+        data_read_this_iteration = read(t_socket,
+                                        t_buffer->data + data_read,
+                                        t_buffer->length - data_read - 1);
+
+        // the connection closed (or failed) before the header was complete
+        if (data_read_this_iteration <= 0)
+        {
+            return -1;
+        }
+
+        data_read += data_read_this_iteration;
+        t_buffer->data[data_read] = '\0';
     }
-    // attempt to create the request buffer
-    if ((req_buf = util_create_request(host, (const char *)page)) == NULL)
+
+    trace_span("ttfb", start);
+
+    t_buffer->length = data_read;
+    return header_end - t_buffer->data + 4;
+}
+
+/**
+ * Reads the socket until t_block holds a complete response header after the
+ * *t_pending bytes already in it, e.g. the start of a pipelined response
+ * that arrived with the one before. The data is null-terminated and
+ * *t_pending is set to the number of bytes held, which may run past the
+ * header.
+ * Returns the length of the header (including the blank line) or -1 upon
+ * failure, including when the header does not fit in t_size bytes.
+ */
+int util_read_next_header(char *t_block, size_t t_size, size_t *t_pending, int t_socket)
+{
+    ssize_t data_read_this_iteration;
+    char *header_end = NULL;
+    long start = trace_now();
+
+    t_block[*t_pending] = '\0';
+
+    while ((header_end = strstr(t_block, "\r\n\r\n")) == NULL)
     {
-        fprintf(stderr, "Could not create req_buf\n");
-        buffer_free(res_buf);
-        return NULL;
+        if (*t_pending == t_size - 1)
+        {
+            return -1;
+        }
+
+        data_read_this_iteration = read(t_socket,
+                                        t_block + *t_pending,
+                                        t_size - *t_pending - 1);
+
+        // the connection closed (or failed) before the header was complete
+        if (data_read_this_iteration <= 0)
+        {
+            return -1;
+        }
+
+        *t_pending += data_read_this_iteration;
+        t_block[*t_pending] = '\0';
     }
 
-    // attempt to create the socket
-    if ((socket = util_create_socket(host, port)) == -1)
+    trace_span("ttfb", start);
+    return header_end - t_block + 4;
+}
+
+/**
+ * Gets the status code from the status line of an HTTP response header.
+ * Returns the status code or -1 if the header is not an HTTP response.
+ */
+int util_get_status(const char *t_header)
+{
+    int status = -1;
+
+    if (sscanf(t_header, "HTTP/%*d.%*d %d", &status) != 1)
     {
-        fprintf(stderr, "Could not create socket to connect to http://%s:%d/\n", host, port);
-        buffer_free(req_buf);
-        buffer_free(res_buf);
-        return NULL;
+        return -1;
     }
 
-    // attempt to send the buffer down the socket
-    if (util_write_buffer_to_socket(req_buf, socket) == -1)
+    return status;
+}
+
+/**
+ * Finds the value of a header field in an HTTP response header. The name is
+ * matched case insensitively and must not include the colon.
+ * Returns a pointer to the value (inside the header) or NULL if the field
+ * is not present.
+ */
+const char *util_get_header_field(const char *t_header, const char *t_name)
+{
+    size_t name_length = strlen(t_name);
+    const char *line = strstr(t_header, "\r\n");
+
+    while (line != NULL && strncmp(line, "\r\n\r\n", 4) != 0)
     {
-        fprintf(stderr, "Could not write req_buf to socket\n");
-        close(socket);
-        buffer_free(req_buf);
-        buffer_free(res_buf);
-        return NULL;
+        line += 2;
+
+        if (strncasecmp(line, t_name, name_length) == 0 && line[name_length] == ':')
+        {
+            const char *value = line + name_length + 1;
+            while (*value == ' ' || *value == '\t')
+            {
+                ++value;
+            }
+            return value;
+        }
+
+        line = strstr(line, "\r\n");
     }
 
-    printf("Data sent ok\n");
+    return NULL;
+}
 
-    // attempt to read the data into the buffer
-    if (util_read_buffer_from_socket(res_buf, socket) != -1)
+/**
+ * Copies the value of a header field, up to the end of its line, into
+ * t_value. The value is truncated to fit.
+ * Returns 0 on success or -1 if the field is not present.
+ */
+int util_copy_header_field(const char *t_header, const char *t_name, char *t_value, size_t t_size)
+{
+    const char *field = util_get_header_field(t_header, t_name);
+    size_t length = 0;
+
+    t_value[0] = '\0';
+
+    if (field == NULL)
     {
-        printf("Data received ok\n%s\n", res_buf->data);
+        return -1;
     }
-    else
+
+    length = strcspn(field, "\r\n");
+    if (length >= t_size)
     {
-        fprintf(stderr, "Could not read socket into res_buf\n");
+        length = t_size - 1;
     }
 
-    // close the socket
-    close(socket);
-
-    // free the request buffer
-    buffer_free(req_buf);
-
-    return res_buf;
+    memcpy(t_value, field, length);
+    t_value[length] = '\0';
+    return 0;
 }
 
 /**
- * Separate the content from the header of an http request.
- * NOTE: returned string is an offset into the response, so
- * should not be freed by the user. Do not copy the data.
- * @param response - Buffer containing the HTTP response to separate 
- *                   content from
- * @return string response or NULL on failure (buffer is not HTTP response)
+ * Formats the header lines making a request conditional on the validators
+ * of a cached copy. The ETag is preferred when both are present.
+ * t_headers is set to an empty string if there is nothing to send.
  */
-char *http_get_content(Buffer *response)
+void util_conditional_headers(const Validators *t_cached, char *t_headers, size_t t_size)
 {
+    t_headers[0] = '\0';
 
-    char *header_end = strstr(response->data, "\r\n\r\n");
-
-    if (header_end)
+    if (t_cached != NULL && t_cached->etag[0] != '\0')
     {
-        return header_end + 4;
+        snprintf(t_headers, t_size, "If-None-Match: %s\r\n", t_cached->etag);
     }
-    else
+    else if (t_cached != NULL && t_cached->last_modified[0] != '\0')
     {
-        return response->data;
+        snprintf(t_headers, t_size, "If-Modified-Since: %s\r\n", t_cached->last_modified);
     }
 }
 
 /**
- * Splits an HTTP url into host, page. On success, calls http_query
- * to execute the query against the url. 
- * @param url - Webpage url e.g. learn.canterbury.ac.nz/profile
- * @param range - The desired byte range of data to retrieve from the page
- * @return Buffer pointer holding raw string data or NULL on failure
+ * Connects to the host and sends a request for the page.
+ * Returns the connected socket or -1 upon failure.
  */
-Buffer *http_url(const char *url, const char *range)
+int util_send_request(const char *t_method, char *t_host, char *t_page, const char *t_range, const char *t_headers, int t_port)
 {
-    char host[BUF_SIZE];
-    strncpy(host, url, BUF_SIZE);
+    struct iovec request[REQUEST_FRAGMENTS];
+    int socket = 0, count = 0;
 
-    char *page = strstr(host, "/");
+    count = util_create_request(request, t_method, t_host, t_page, t_range, t_headers, HTTP_1_0);
 
-    if (page)
+    // attempt to create the socket
+    if ((socket = util_create_socket(t_host, t_port)) == -1)
     {
-        page[0] = '\0';
-
-        ++page;
-        return http_query(host, page, range, 80);
+        fprintf(stderr, "Could not create socket to connect to http://%s:%d/\n", t_host, t_port);
+        return -1;
     }
-    else
-    {
 
-        fprintf(stderr, "could not split url into host/page %s\n", url);
-        return NULL;
+    long start = trace_now();
+
+    // attempt to send the request down the socket
+    if (util_write_request_to_socket(request, count, socket) == -1)
+    {
+        fprintf(stderr, "Could not write request to socket\n");
+        close(socket);
+        return -1;
     }
+
+    trace_span("send", start);
+    return socket;
 }
 
 /**
- * Makes a HEAD request to a given URL and gets the content length
- * Then determines max_chunk_size and number of split downloads needed
- * @param url   The URL of the resource to download
- * @param threads   The number of threads to be used for the download
- * @return int  The number of downloads needed satisfying max_chunk_size
- *              to download the resource
+ * Splits an HTTP url into host, page and port. An "http://" scheme is
+ * skipped, in any case, and other schemes are refused. The page is written
+ * into t_host after the host, so both point into the caller's t_host
+ * storage. A port other than 80 stays on the host, as the Host header
+ * has to carry it, and is also returned in t_port.
+ * Returns 0 on success or -1 if the url has no page or a bad port.
  */
-int get_num_tasks(char *url, int threads)
+int util_split_url(const char *t_url, char *t_host, char **t_page, int *t_port)
 {
-    assert(0 && "not implemented yet!");
-}
+    if (strncasecmp(t_url, "http://", 7) == 0)
+    {
+        t_url += 7;
+    }
 
-int get_max_chunk_size()
-{
-    return max_chunk_size;
+    strncpy(t_host, t_url, BUF_SIZE - 1);
+    t_host[BUF_SIZE - 1] = '\0';
+
+    char *page = strstr(t_host, "/");
+
+    if (page == NULL || strstr(t_url, "://") != NULL)
+    {
+        fprintf(stderr, "could not split url into host/page %s\n", t_url);
+        return -1;
+    }
+
+    page[0] = '\0';
+    *t_page = page + 1;
+    *t_port = 80;
+
+    char *port = strchr(t_host, ':');
+
+    if (port != NULL)
+    {
+        char *end = NULL;
+        long number = strtol(port + 1, &end, 10);
+
+        if (end == port + 1 || *end != '\0' || number < 1 || number > 65535)
+        {
+            fprintf(stderr, "could not read the port of url %s\n", t_url);
+            return -1;
+        }
+
+        *t_port = (int)number;
+
+        if (number == 80)
+        {
+            port[0] = '\0';
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Perform an HTTP 1.0 query to a given host and page and port number.
+ * host is a hostname and page is a path on the remote server. The query
+ * will attempt to retrievev content in the given byte range.
+ * User is responsible for freeing the memory.
+ * 
+ * @param host - The host name e.g. www.canterbury.ac.nz
+ * @param page - e.g. /index.html
+ * @param range - Byte range e.g. 0-500. NOTE: A server may not respect this
+ * @param port - e.g. 80
+ * @return Buffer - Pointer to a buffer holding response data from query
+ *                  NULL is returned on failure.
+ */
+Buffer *http_query(char *host, char *page, const char *range, int port)
+{
+    Buffer *res_buf = NULL;
+    int socket = 0;
+
+    // attempt to create the response buffer
+    if ((res_buf = buffer_create(BUF_SIZE)) == NULL)
+    {
+        fprintf(stderr, "Could not create res_buf\n");
+        return NULL;
+    }
+
+    // attempt to connect and send the request
+    if ((socket = util_send_request("GET", host, page, range, NULL, port)) == -1)
+    {
+        buffer_free(res_buf);
+        return NULL;
+    }
+
+    // attempt to read the data into the buffer
+    if (util_read_buffer_from_socket(res_buf, socket) == -1)
+    {
+        fprintf(stderr, "Could not read socket into res_buf\n");
+    }
+
+    // close the socket
+    close(socket);
+
+    return res_buf;
+}
+
+/**
+ * Perform an HTTP 1.0 query to a given host and page and port number, reading
+ * the content of the response directly into dest. Only the header is
+ * buffered; the content is never copied through an intermediate buffer.
+ * 
+ * @param host - The host name e.g. www.canterbury.ac.nz
+ * @param page - e.g. /index.html
+ * @param range - Byte range e.g. 0-500. The server must respect this.
+ * @param port - e.g. 80
+ * @param dest - Memory to write the content to
+ * @param length - The number of content bytes expected
+ * @return The number of content bytes written to dest or -1 on failure
+ */
+ssize_t http_query_into(char *host, char *page, const char *range, int port, char *dest, size_t length)
+{
+    Buffer *header = NULL;
+    int socket = 0, header_length = 0, status = 0;
+    size_t data_read = 0;
+    ssize_t data_read_this_iteration;
+
+    if ((header = buffer_create(BUF_SIZE)) == NULL)
+    {
+        fprintf(stderr, "Could not create header buffer\n");
+        return -1;
+    }
+
+    if ((socket = util_send_request("GET", host, page, range, NULL, port)) == -1)
+    {
+        buffer_free(header);
+        return -1;
+    }
+
+    if ((header_length = util_read_header_from_socket(header, socket)) == -1)
+    {
+        fprintf(stderr, "Could not read header from http://%s/%s\n", host, page);
+        close(socket);
+        buffer_free(header);
+        return -1;
+    }
+
+    // a server ignoring the range would send the wrong bytes for this chunk
+    status = util_get_status(header->data);
+    if (status != (range[0] != '\0' ? 206 : 200))
+    {
+        fprintf(stderr, "Unexpected status %d from http://%s/%s\n", status, host, page);
+        close(socket);
+        buffer_free(header);
+        return -1;
+    }
+
+    long start = trace_now();
+
+    // content that arrived with the header
+    data_read = header->length - header_length;
+    if (data_read > length)
+    {
+        data_read = length;
+    }
+    memcpy(dest, header->data + header_length, data_read);
+    buffer_free(header);
+
+    while (data_read < length)
+    {
+        data_read_this_iteration = read(socket, dest + data_read, length - data_read);
+
+        if (data_read_this_iteration == -1)
+        {
+            close(socket);
+            return -1;
+        }
+
+        if (data_read_this_iteration == 0)
+        {
+            break;
+        }
+
+        data_read += data_read_this_iteration;
+    }
+
+    trace_span("transfer", start);
+
+    close(socket);
+    return data_read;
+}
+
+/**
+ * Perform an HTTP 1.0 query to a given host and page and port number,
+ * streaming the content of the response through a decoder for its
+ * Content-Encoding into a sink. Only one block of the response is held in
+ * memory at a time.
+ * 
+ * @param host - The host name e.g. www.canterbury.ac.nz
+ * @param page - e.g. /index.html
+ * @param range - Byte range e.g. 0-500. The server must respect this.
+ * @param port - e.g. 80
+ * @param sink - Called with each block of decoded content
+ * @param arg - Passed to the sink
+ * @return The number of decoded bytes passed to the sink or -1 on failure
+ */
+long http_query_stream(char *host, char *page, const char *range, int port, DecodeSink sink, void *arg)
+{
+    Buffer *buffer = NULL;
+    Decoder *decoder = NULL;
+    const char *field = NULL;
+    int socket = 0, header_length = 0, status = 0, rc = 0;
+    ssize_t data_read_this_iteration;
+    long long expected = -1, data_read = 0;
+    long total = -1;
+
+    if ((buffer = buffer_create(STREAM_BUF_SIZE)) == NULL)
+    {
+        fprintf(stderr, "Could not create stream buffer\n");
+        return -1;
+    }
+
+    if ((socket = util_send_request("GET", host, page, range, NULL, port)) == -1)
+    {
+        buffer_free(buffer);
+        return -1;
+    }
+
+    if ((header_length = util_read_header_from_socket(buffer, socket)) == -1)
+    {
+        fprintf(stderr, "Could not read header from http://%s/%s\n", host, page);
+        close(socket);
+        buffer_free(buffer);
+        return -1;
+    }
+
+    status = util_get_status(buffer->data);
+    if (status != (range[0] != '\0' ? 206 : 200))
+    {
+        fprintf(stderr, "Unexpected status %d from http://%s/%s\n", status, host, page);
+        close(socket);
+        buffer_free(buffer);
+        return -1;
+    }
+
+    // the length as sent, before decoding, to tell a response cut short
+    if ((field = util_get_header_field(buffer->data, "Content-Length")) != NULL)
+    {
+        expected = strtoll(field, NULL, 10);
+    }
+
+    decoder = decoder_alloc(util_get_header_field(buffer->data, "Content-Encoding"), sink, arg);
+    if (decoder == NULL)
+    {
+        close(socket);
+        buffer_free(buffer);
+        return -1;
+    }
+
+    long start = trace_now();
+
+    // content that arrived with the header
+    data_read = buffer->length - header_length;
+    rc = decoder_write(decoder, buffer->data + header_length, data_read);
+
+    while (rc == 0)
+    {
+        data_read_this_iteration = read(socket, buffer->data, STREAM_BUF_SIZE);
+
+        if (data_read_this_iteration <= 0)
+        {
+            rc = data_read_this_iteration;
+            break;
+        }
+
+        data_read += data_read_this_iteration;
+        rc = decoder_write(decoder, buffer->data, data_read_this_iteration);
+    }
+
+    if (rc == 0 && expected != -1 && data_read != expected)
+    {
+        fprintf(stderr, "Received %lld of %lld bytes from http://%s/%s\n", data_read, expected, host, page);
+        rc = -1;
+    }
+
+    if (rc == 0)
+    {
+        total = decoder_finish(decoder);
+    }
+
+    trace_span("transfer", start);
+
+    close(socket);
+    decoder_free(decoder);
+    buffer_free(buffer);
+
+    return total;
+}
+
+/**
+ * Perform several range queries for one page over a single keep-alive
+ * HTTP/1.1 connection, reading the content of each response directly into
+ * its destination. Every request is sent at once, so the server answers
+ * them back to back with no round trip or connection setup between ranges.
+ * A server that closes the connection early completes only some of the
+ * ranges; the rest can be fetched again.
+ * 
+ * @param host - The host name e.g. www.canterbury.ac.nz
+ * @param page - e.g. /index.html
+ * @param ranges - The byte ranges e.g. 0-500. The server must respect these.
+ * @param count - The number of ranges
+ * @param port - e.g. 80
+ * @param dests - Memory to write the content of each range to
+ * @param lengths - The number of content bytes expected for each range
+ * @return The number of ranges received in full, which are always the
+ *         first ones, or -1 if the requests could not be sent
+ */
+int http_query_pipelined(char *host, char *page, const char **ranges, int count, int port,
+                         char **dests, const size_t *lengths)
+{
+    struct iovec *request = NULL;
+    char *block = NULL;
+    const char *field = NULL;
+    int socket = 0, fragments = 0, header_length = 0, done = 0, status = 0;
+    size_t pending = 0, data_read = 0;
+    ssize_t data_read_this_iteration;
+
+    request = malloc(sizeof(struct iovec) * REQUEST_FRAGMENTS * count);
+    block = malloc(STREAM_BUF_SIZE);
+
+    if (request == NULL || block == NULL)
+    {
+        fprintf(stderr, "Could not create pipelined request\n");
+        free(request);
+        free(block);
+        return -1;
+    }
+
+    // the server closes the connection once it has answered the last range
+    for (int i = 0; i < count; ++i)
+    {
+        fragments += util_create_request(request + fragments, "GET", host, page, ranges[i],
+                                         i == count - 1 ? "Connection: close\r\n" : NULL, HTTP_1_1);
+    }
+
+    if ((socket = util_create_socket(host, port)) == -1 ||
+        util_write_request_to_socket(request, fragments, socket) == -1)
+    {
+        fprintf(stderr, "Could not send pipelined requests to http://%s:%d/\n", host, port);
+        if (socket != -1)
+        {
+            close(socket);
+        }
+        free(request);
+        free(block);
+        return -1;
+    }
+
+    free(request);
+
+    for (done = 0; done < count; ++done)
+    {
+        util_quick_ack(socket);
+
+        if ((header_length = util_read_next_header(block, STREAM_BUF_SIZE, &pending, socket)) == -1)
+        {
+            break;
+        }
+
+        // the next response starts right after this one's content, so its
+        // length must be known and exactly the range
+        status = util_get_status(block);
+        field = util_get_header_field(block, "Content-Length");
+
+        if (status != 206 || field == NULL || strtoul(field, NULL, 10) != lengths[done])
+        {
+            fprintf(stderr, "Unexpected status %d from http://%s/%s\n", status, host, page);
+            break;
+        }
+
+        long start = trace_now();
+
+        // content that arrived with the header
+        data_read = pending - header_length;
+        if (data_read > lengths[done])
+        {
+            data_read = lengths[done];
+        }
+        memcpy(dests[done], block + header_length, data_read);
+
+        // keep the start of the next response
+        pending -= header_length + data_read;
+        memmove(block, block + header_length + data_read, pending);
+
+        while (data_read < lengths[done])
+        {
+            data_read_this_iteration = read(socket, dests[done] + data_read, lengths[done] - data_read);
+
+            if (data_read_this_iteration <= 0)
+            {
+                break;
+            }
+
+            data_read += data_read_this_iteration;
+        }
+
+        trace_span("transfer", start);
+
+        if (data_read < lengths[done])
+        {
+            break;
+        }
+    }
+
+    close(socket);
+    free(block);
+
+    return done;
+}
+
+/**
+ * Separate the content from the header of an http request.
+ * NOTE: returned string is an offset into the response, so
+ * should not be freed by the user. Do not copy the data.
+ * @param response - Buffer containing the HTTP response to separate 
+ *                   content from
+ * @return string response or NULL on failure (buffer is not HTTP response)
+ */
+char *http_get_content(Buffer *response)
+{
+
+    char *header_end = strstr(response->data, "\r\n\r\n");
+
+    if (header_end)
+    {
+        return header_end + 4;
+    }
+    else
+    {
+        return response->data;
+    }
+}
+
+/**
+ * Get the status code of an HTTP response
+ * @param response - Buffer containing the HTTP response
+ * @return The status code e.g. 206, or -1 if the buffer is not a response
+ */
+int http_get_status(Buffer *response)
+{
+    return util_get_status(response->data);
+}
+
+/**
+ * Check the content of a response is as long as its Content-Length says,
+ * i.e. the connection was not closed part way through
+ * @param response - Buffer containing the HTTP response
+ * @return 1 if the content is complete or there is no Content-Length,
+ *         0 if it was cut short
+ */
+int http_get_complete(Buffer *response)
+{
+    const char *field = util_get_header_field(response->data, "Content-Length");
+    char *content = http_get_content(response);
+
+    if (field == NULL || content == response->data)
+    {
+        return field == NULL;
+    }
+
+    return strtoll(field, NULL, 10) == (long long)(response->length - (content - response->data));
+}
+
+/**
+ * Splits an HTTP url into host, page. On success, calls http_query
+ * to execute the query against the url. 
+ * @param url - Webpage url e.g. learn.canterbury.ac.nz/profile
+ * @param range - The desired byte range of data to retrieve from the page
+ * @return Buffer pointer holding raw string data or NULL on failure
+ */
+Buffer *http_url(const char *url, const char *range)
+{
+    char host[BUF_SIZE];
+    char *page = NULL;
+    int port = 80;
+
+    if (util_split_url(url, host, &page, &port) == -1)
+    {
+        return NULL;
+    }
+
+    return http_query(host, page, range, port);
+}
+
+/**
+ * Splits an HTTP url into host, page. On success, calls http_query_into
+ * to read the content at the url directly into dest.
+ * @param url - Webpage url e.g. learn.canterbury.ac.nz/profile
+ * @param range - The desired byte range of data to retrieve from the page
+ * @param dest - Memory to write the content to e.g. a slice of a mapped file
+ * @param length - The number of content bytes expected
+ * @return The number of content bytes written to dest or -1 on failure
+ */
+ssize_t http_url_into(const char *url, const char *range, char *dest, size_t length)
+{
+    char host[BUF_SIZE];
+    char *page = NULL;
+    int port = 80;
+
+    if (util_split_url(url, host, &page, &port) == -1)
+    {
+        return -1;
+    }
+
+    return http_query_into(host, page, range, port, dest, length);
+}
+
+/**
+ * Splits an HTTP url into host, page. On success, calls http_query_stream
+ * to stream the decoded content at the url into a sink.
+ * @param url - Webpage url e.g. learn.canterbury.ac.nz/profile
+ * @param range - The desired byte range of data to retrieve from the page
+ * @param sink - Called with each block of decoded content
+ * @param arg - Passed to the sink
+ * @return The number of decoded bytes passed to the sink or -1 on failure
+ */
+long http_url_stream(const char *url, const char *range, DecodeSink sink, void *arg)
+{
+    char host[BUF_SIZE];
+    char *page = NULL;
+    int port = 80;
+
+    if (util_split_url(url, host, &page, &port) == -1)
+    {
+        return -1;
+    }
+
+    return http_query_stream(host, page, range, port, sink, arg);
+}
+
+/**
+ * Splits an HTTP url into host, page. On success, calls
+ * http_query_pipelined to read several ranges of the url over one
+ * connection.
+ * @param url - Webpage url e.g. learn.canterbury.ac.nz/profile
+ * @param ranges - The byte ranges to retrieve from the page
+ * @param count - The number of ranges
+ * @param dests - Memory to write the content of each range to
+ * @param lengths - The number of content bytes expected for each range
+ * @return The number of ranges received in full, which are always the
+ *         first ones, or -1 on failure
+ */
+int http_url_pipelined(const char *url, const char **ranges, int count, char **dests, const size_t *lengths)
+{
+    char host[BUF_SIZE];
+    char *page = NULL;
+    int port = 80;
+
+    if (util_split_url(url, host, &page, &port) == -1)
+    {
+        return -1;
+    }
+
+    return http_query_pipelined(host, page, ranges, count, port, dests, lengths);
+}
+
+/**
+ * Enables or disables asking servers to compress unranged responses.
+ * Must be called before any requests are made.
+ * @param enabled - Whether to send an Accept-Encoding header
+ */
+void http_set_accept_encoding(bool enabled)
+{
+    accept_encoding = enabled;
+}
+
+/**
+ * Splits t_length bytes into chunks, one per thread, but none larger than
+ * MAX_CHUNK_SIZE so a chunk held in memory stays small however large the
+ * resource is.
+ * Returns the number of chunks and sets *t_chunk_size to their size.
+ */
+int util_split_length(off_t t_length, int t_threads, off_t *t_chunk_size)
+{
+    *t_chunk_size = t_threads > 1 ? (t_length + t_threads - 1) / t_threads : t_length;
+
+    if (*t_chunk_size > MAX_CHUNK_SIZE)
+    {
+        *t_chunk_size = MAX_CHUNK_SIZE;
+    }
+
+    return (t_length + *t_chunk_size - 1) / *t_chunk_size;
+}
+
+/**
+ * Makes a HEAD request to a given URL and gets the content length
+ * Then determines max_chunk_size and number of split downloads needed
+ * @param url   The URL of the resource to download
+ * @param threads   The number of threads to be used for the download
+ * @return int  The number of downloads needed satisfying max_chunk_size
+ *              to download the resource
+ */
+int get_num_tasks(char *url, int threads)
+{
+    return get_num_tasks_conditional(url, threads, NULL, NULL);
+}
+
+/**
+ * Makes a HEAD request to a given URL, conditional on the validators of a
+ * cached copy, and gets the content length. Then determines max_chunk_size
+ * and number of split downloads needed.
+ * @param url   The URL of the resource to download
+ * @param threads   The number of threads to be used for the download
+ * @param cached    Validators of a cached copy, or NULL
+ * @param current   Filled with the validators of the resource, or NULL
+ * @return int  0 if the cached copy is still valid, otherwise the number of
+ *              downloads needed satisfying max_chunk_size
+ */
+int get_num_tasks_conditional(char *url, int threads, const Validators *cached, Validators *current)
+{
+    return http_plan(url, threads, cached, current, &max_chunk_size, &content_length);
+}
+
+/**
+ * Makes a HEAD request to a given URL, conditional on the validators of a
+ * cached copy, and plans how to split the download. Unlike get_num_tasks
+ * this uses no globals, so it can be called from many threads at once.
+ * @param url   The URL of the resource to download
+ * @param threads   The number of threads to be used for the download
+ * @param cached    Validators of a cached copy, or NULL
+ * @param current   Filled with the validators of the resource, or NULL
+ * @param chunk_size    Filled with the maximum size in bytes of a chunk
+ * @param length    Filled with the size of the resource, -1 if unknown
+ * @return int  0 if the cached copy is still valid, otherwise the number of
+ *              downloads needed satisfying chunk_size
+ */
+int http_plan(char *url, int threads, const Validators *cached, Validators *current, off_t *chunk_size, off_t *length)
+{
+    char host[BUF_SIZE];
+    char headers[VALIDATOR_SIZE + 32];
+    char *page = NULL;
+    Buffer *header = NULL;
+    const char *field = NULL;
+    int socket = 0, status = -1, port = 80;
+    bool accepts_ranges = false;
+
+    // a single request for the whole resource unless we learn otherwise
+    *length = -1;
+    *chunk_size = 0;
+
+    if (current != NULL)
+    {
+        current->etag[0] = '\0';
+        current->last_modified[0] = '\0';
+    }
+
+    util_conditional_headers(cached, headers, sizeof(headers));
+
+    if (util_split_url(url, host, &page, &port) == -1)
+    {
+        return 1;
+    }
+
+    if ((header = buffer_create(BUF_SIZE)) == NULL)
+    {
+        return 1;
+    }
+
+    if ((socket = util_send_request("HEAD", host, page, "", headers, port)) == -1)
+    {
+        buffer_free(header);
+        return 1;
+    }
+
+    if (util_read_header_from_socket(header, socket) != -1)
+    {
+        status = util_get_status(header->data);
+    }
+
+    if (status == 200)
+    {
+        if ((field = util_get_header_field(header->data, "Content-Length")) != NULL)
+        {
+            *length = strtoll(field, NULL, 10);
+        }
+
+        field = util_get_header_field(header->data, "Accept-Ranges");
+        accepts_ranges = field != NULL && strncasecmp(field, "bytes", 5) == 0;
+
+        // compressed content must be fetched as a single stream, and its
+        // decoded length is unknown until it has been decoded
+        field = util_get_header_field(header->data, "Content-Encoding");
+        if (field != NULL && strncasecmp(field, "identity", 8) != 0)
+        {
+            *length = -1;
+        }
+    }
+
+    if (current != NULL && (status == 200 || status == 304))
+    {
+        util_copy_header_field(header->data, "ETag", current->etag, VALIDATOR_SIZE);
+        util_copy_header_field(header->data, "Last-Modified", current->last_modified, VALIDATOR_SIZE);
+    }
+
+    close(socket);
+    buffer_free(header);
+
+    if (status == 304 && cached != NULL)
+    {
+        return 0;
+    }
+
+    if (*length <= 0 || !accepts_ranges)
+    {
+        *chunk_size = *length > 0 ? *length : 0;
+        return 1;
+    }
+
+    return util_split_length(*length, threads, chunk_size);
+}
+
+/**
+ * Plans a download by speculatively requesting the first first_size bytes
+ * of the resource with a ranged GET, conditional on the validators of a
+ * cached copy. The total size comes from the Content-Range of the response
+ * and the bytes received are kept as the first chunk, so a small resource
+ * needs only this one request. Can be called from many threads at once.
+ * @param url   The URL of the resource to download
+ * @param threads   The number of threads to be used for the download
+ * @param first_size    The number of bytes to request speculatively
+ * @param cached    Validators of a cached copy, or NULL
+ * @param current   Filled with the validators of the resource, or NULL
+ * @param chunk_size    Filled with the maximum size in bytes of the chunks
+ *                      after the first
+ * @param length    Filled with the size of the resource, -1 if unknown
+ * @param first     Filled with the content of the first chunk, or NULL if
+ *                  none was kept
+ * @return int  0 if the cached copy is still valid, otherwise the number of
+ *              downloads needed including the first chunk
+ */
+int http_plan_speculative(char *url, int threads, int first_size, const Validators *cached,
+                          Validators *current, off_t *chunk_size, off_t *length, Buffer **first)
+{
+    char host[BUF_SIZE], range[64];
+    char headers[VALIDATOR_SIZE + 32];
+    char *page = NULL;
+    Buffer *header = NULL, *content = NULL;
+    const char *field = NULL;
+    int socket = 0, status = -1, header_length = -1, port = 80;
+    long long start = 0, end = -1, total = -1;
+    size_t data_read = 0;
+    ssize_t data_read_this_iteration;
+
+    // a single request for the whole resource unless we learn otherwise
+    *length = -1;
+    *chunk_size = 0;
+    *first = NULL;
+
+    if (current != NULL)
+    {
+        current->etag[0] = '\0';
+        current->last_modified[0] = '\0';
+    }
+
+    util_conditional_headers(cached, headers, sizeof(headers));
+    snprintf(range, sizeof(range), "0-%d", first_size - 1);
+
+    if (util_split_url(url, host, &page, &port) == -1 || (header = buffer_create(BUF_SIZE)) == NULL)
+    {
+        return 1;
+    }
+
+    if ((socket = util_send_request("GET", host, page, range, headers, port)) == -1)
+    {
+        buffer_free(header);
+        return 1;
+    }
+
+    if ((header_length = util_read_header_from_socket(header, socket)) != -1)
+    {
+        status = util_get_status(header->data);
+    }
+
+    if (current != NULL && (status == 200 || status == 206 || status == 304))
+    {
+        util_copy_header_field(header->data, "ETag", current->etag, VALIDATOR_SIZE);
+        util_copy_header_field(header->data, "Last-Modified", current->last_modified, VALIDATOR_SIZE);
+    }
+
+    if (status == 206)
+    {
+        field = util_get_header_field(header->data, "Content-Range");
+        if (field == NULL || sscanf(field, "bytes %lld-%lld/%lld", &start, &end, &total) != 3 || start != 0)
+        {
+            end = -1;
+        }
+    }
+    else if (status == 200)
+    {
+        // the server ignored the range; only keep the content if it is small
+        field = util_get_header_field(header->data, "Content-Length");
+        if (field != NULL && (total = strtoll(field, NULL, 10)) <= first_size)
+        {
+            end = total - 1;
+        }
+    }
+
+    // keep the content received as the first chunk
+    if (end >= 0 && end < total && end < first_size && (content = buffer_create(end + 2)) != NULL)
+    {
+        long start = trace_now();
+
+        data_read = header->length - header_length;
+        if (data_read > end + 1)
+        {
+            data_read = end + 1;
+        }
+        memcpy(content->data, header->data + header_length, data_read);
+
+        while (data_read < end + 1)
+        {
+            data_read_this_iteration = read(socket, content->data + data_read, end + 1 - data_read);
+
+            if (data_read_this_iteration <= 0)
+            {
+                break;
+            }
+
+            data_read += data_read_this_iteration;
+        }
+
+        trace_span("transfer", start);
+        content->length = data_read;
+
+        if (data_read != end + 1)
+        {
+            buffer_free(content);
+            content = NULL;
+        }
+    }
+
+    close(socket);
+    buffer_free(header);
+
+    if (status == 304 && cached != NULL)
+    {
+        return 0;
+    }
+
+    if (content == NULL)
+    {
+        return 1;
+    }
+
+    *first = content;
+    *length = total;
+
+    if (total == content->length)
+    {
+        return 1;
+    }
+
+    // split what is left between the threads
+    return 1 + util_split_length(total - content->length, threads, chunk_size);
+}
+
+off_t get_max_chunk_size()
+{
+    return max_chunk_size;
+}
+
+off_t get_content_length()
+{
+    return content_length;
 }
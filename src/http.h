@@ -1,6 +1,17 @@
 #ifndef HTTP_H
 #define HTTP_H
 
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "decode.h"
+
+#define VALIDATOR_SIZE 128
+
+// The largest chunk a download is split into, in bytes
+#define MAX_CHUNK_SIZE ((off_t)64 * 1024 * 1024)
+
 
 // A buffer object with data, and a length
 typedef struct {
@@ -10,6 +21,14 @@ typedef struct {
 } Buffer;
 
 
+// The validators of a resource, used to make a conditional request
+typedef struct {
+    char etag[VALIDATOR_SIZE];          // ETag header, empty if none
+    char last_modified[VALIDATOR_SIZE]; // Last-Modified header, empty if none
+
+} Validators;
+
+
 /**
  * Perform an HTTP 1.0 query to a given host and page and port number.
  * host is a hostname and page is a path on the remote server. The query
@@ -26,6 +45,61 @@ typedef struct {
 Buffer* http_query(char *host, char *page, const char *range, int port);
 
 
+/**
+ * Perform an HTTP 1.0 query to a given host and page and port number, reading
+ * the content of the response directly into dest. Only the header is
+ * buffered; the content is never copied through an intermediate buffer.
+ * 
+ * @param host - The host name e.g. www.canterbury.ac.nz
+ * @param page - e.g. /index.html
+ * @param range - Byte range e.g. 0-500. The server must respect this.
+ * @param port - e.g. 80
+ * @param dest - Memory to write the content to
+ * @param length - The number of content bytes expected
+ * @return The number of content bytes written to dest or -1 on failure
+ */
+ssize_t http_query_into(char *host, char *page, const char *range, int port, char *dest, size_t length);
+
+
+/**
+ * Perform an HTTP 1.0 query to a given host and page and port number,
+ * streaming the content of the response through a decoder for its
+ * Content-Encoding into a sink. Only one block of the response is held in
+ * memory at a time.
+ * 
+ * @param host - The host name e.g. www.canterbury.ac.nz
+ * @param page - e.g. /index.html
+ * @param range - Byte range e.g. 0-500. The server must respect this.
+ * @param port - e.g. 80
+ * @param sink - Called with each block of decoded content
+ * @param arg - Passed to the sink
+ * @return The number of decoded bytes passed to the sink or -1 on failure
+ */
+long http_query_stream(char *host, char *page, const char *range, int port, DecodeSink sink, void *arg);
+
+
+/**
+ * Perform several range queries for one page over a single keep-alive
+ * HTTP/1.1 connection, reading the content of each response directly into
+ * its destination. Every request is sent at once, so the server answers
+ * them back to back with no round trip or connection setup between ranges.
+ * A server that closes the connection early completes only some of the
+ * ranges; the rest can be fetched again.
+ * 
+ * @param host - The host name e.g. www.canterbury.ac.nz
+ * @param page - e.g. /index.html
+ * @param ranges - The byte ranges e.g. 0-500. The server must respect these.
+ * @param count - The number of ranges
+ * @param port - e.g. 80
+ * @param dests - Memory to write the content of each range to
+ * @param lengths - The number of content bytes expected for each range
+ * @return The number of ranges received in full, which are always the
+ *         first ones, or -1 if the requests could not be sent
+ */
+int http_query_pipelined(char *host, char *page, const char **ranges, int count, int port,
+                         char **dests, const size_t *lengths);
+
+
 /**
  * Separate the content from the header of an http request.
  * NOTE: returned string is an offset into the response, so
@@ -37,6 +111,24 @@ Buffer* http_query(char *host, char *page, const char *range, int port);
 char* http_get_content(Buffer *response);
 
 
+/**
+ * Get the status code of an HTTP response
+ * @param response - Buffer containing the HTTP response
+ * @return The status code e.g. 206, or -1 if the buffer is not a response
+ */
+int http_get_status(Buffer *response);
+
+
+/**
+ * Check the content of a response is as long as its Content-Length says,
+ * i.e. the connection was not closed part way through
+ * @param response - Buffer containing the HTTP response
+ * @return 1 if the content is complete or there is no Content-Length,
+ *         0 if it was cut short
+ */
+int http_get_complete(Buffer *response);
+
+
 /**
  * Splits an HTTP url into host, page. On success, calls http_query
  * to execute the query against the url. 
@@ -47,6 +139,53 @@ char* http_get_content(Buffer *response);
 Buffer *http_url(const char *url, const char *range);
 
 
+/**
+ * Splits an HTTP url into host, page. On success, calls http_query_into
+ * to read the content at the url directly into dest.
+ * @param url - Webpage url e.g. learn.canterbury.ac.nz/profile
+ * @param range - The desired byte range of data to retrieve from the page
+ * @param dest - Memory to write the content to e.g. a slice of a mapped file
+ * @param length - The number of content bytes expected
+ * @return The number of content bytes written to dest or -1 on failure
+ */
+ssize_t http_url_into(const char *url, const char *range, char *dest, size_t length);
+
+
+/**
+ * Splits an HTTP url into host, page. On success, calls http_query_stream
+ * to stream the decoded content at the url into a sink.
+ * @param url - Webpage url e.g. learn.canterbury.ac.nz/profile
+ * @param range - The desired byte range of data to retrieve from the page
+ * @param sink - Called with each block of decoded content
+ * @param arg - Passed to the sink
+ * @return The number of decoded bytes passed to the sink or -1 on failure
+ */
+long http_url_stream(const char *url, const char *range, DecodeSink sink, void *arg);
+
+
+/**
+ * Splits an HTTP url into host, page. On success, calls
+ * http_query_pipelined to read several ranges of the url over one
+ * connection.
+ * @param url - Webpage url e.g. learn.canterbury.ac.nz/profile
+ * @param ranges - The byte ranges to retrieve from the page
+ * @param count - The number of ranges
+ * @param dests - Memory to write the content of each range to
+ * @param lengths - The number of content bytes expected for each range
+ * @return The number of ranges received in full, which are always the
+ *         first ones, or -1 on failure
+ */
+int http_url_pipelined(const char *url, const char **ranges, int count, char **dests, const size_t *lengths);
+
+
+/**
+ * Enables or disables asking servers to compress unranged responses.
+ * Must be called before any requests are made.
+ * @param enabled - Whether to send an Accept-Encoding header
+ */
+void http_set_accept_encoding(bool enabled);
+
+
 /**
  * Free a buffer
  * @param buffer - Pointer to a buffer to free
@@ -59,7 +198,8 @@ inline static void buffer_free(Buffer *buffer) {
 
 /**
  * Makes a HEAD request to a given URL and gets the content length
- * maxByteSize is set from this, and number of split downloads determined
+ * maxByteSize is set from this, and number of split downloads determined.
+ * Content the server would compress is always a single download.
  * @param url   The URL of the resource to download
  * @param threads   The number of threads to be used for the download
  * @return int  The number of downloads needed satisfying maxByteSize
@@ -67,8 +207,64 @@ inline static void buffer_free(Buffer *buffer) {
  */
 int get_num_tasks(char *url, int threads);
 
-int max_chunk_size; // The maximum size in bytes of a chunk to download
 
-int get_max_chunk_size(void);
+/**
+ * Makes a HEAD request to a given URL, conditional on the validators of a
+ * cached copy, and gets the content length. Then determines max_chunk_size
+ * and number of split downloads needed.
+ * @param url   The URL of the resource to download
+ * @param threads   The number of threads to be used for the download
+ * @param cached    Validators of a cached copy, or NULL
+ * @param current   Filled with the validators of the resource, or NULL
+ * @return int  0 if the cached copy is still valid, otherwise the number of
+ *              downloads needed satisfying max_chunk_size
+ */
+int get_num_tasks_conditional(char *url, int threads, const Validators *cached, Validators *current);
+
+
+/**
+ * Makes a HEAD request to a given URL, conditional on the validators of a
+ * cached copy, and plans how to split the download. Unlike get_num_tasks
+ * this uses no globals, so it can be called from many threads at once.
+ * @param url   The URL of the resource to download
+ * @param threads   The number of threads to be used for the download
+ * @param cached    Validators of a cached copy, or NULL
+ * @param current   Filled with the validators of the resource, or NULL
+ * @param chunk_size    Filled with the maximum size in bytes of a chunk
+ * @param length    Filled with the size of the resource, -1 if unknown
+ * @return int  0 if the cached copy is still valid, otherwise the number of
+ *              downloads needed satisfying chunk_size
+ */
+int http_plan(char *url, int threads, const Validators *cached, Validators *current, off_t *chunk_size, off_t *length);
+
+
+/**
+ * Plans a download by speculatively requesting the first first_size bytes
+ * of the resource with a ranged GET, conditional on the validators of a
+ * cached copy. The total size comes from the Content-Range of the response
+ * and the bytes received are kept as the first chunk, so a small resource
+ * needs only this one request. Can be called from many threads at once.
+ * @param url   The URL of the resource to download
+ * @param threads   The number of threads to be used for the download
+ * @param first_size    The number of bytes to request speculatively
+ * @param cached    Validators of a cached copy, or NULL
+ * @param current   Filled with the validators of the resource, or NULL
+ * @param chunk_size    Filled with the maximum size in bytes of the chunks
+ *                      after the first
+ * @param length    Filled with the size of the resource, -1 if unknown
+ * @param first     Filled with the content of the first chunk, or NULL if
+ *                  none was kept
+ * @return int  0 if the cached copy is still valid, otherwise the number of
+ *              downloads needed including the first chunk
+ */
+int http_plan_speculative(char *url, int threads, int first_size, const Validators *cached,
+                          Validators *current, off_t *chunk_size, off_t *length, Buffer **first);
+
+extern off_t max_chunk_size; // The maximum size in bytes of a chunk to download
+extern off_t content_length; // The size in bytes of the resource, -1 if unknown
+
+off_t get_max_chunk_size(void);
+
+off_t get_content_length(void);
 
 #endif
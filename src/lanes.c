@@ -0,0 +1,87 @@
+#include "lanes.h"
+
+#include <stdlib.h>
+
+
+struct LanesStruct {
+    RangeSet *remaining;
+    int open;           // Lanes not retired yet, updated atomically
+    int retries;        // Failed chunks left to put back, updated atomically
+    int failed;         // Chunks failed for good, updated atomically
+};
+
+
+/**
+ * Allocate the lanes of a download, with none open yet
+ * @param remaining - The ranges of the download not handed out yet, which
+ *                    the lanes carve chunks off. Not owned by the lanes.
+ * @param retries - The most failed chunks put back to be fetched again
+ * @return lanes - Pointer to the lanes
+ */
+Lanes *lanes_alloc(RangeSet *remaining, int retries) {
+    Lanes *lanes = (Lanes *)malloc(sizeof(Lanes));
+    lanes->remaining = remaining;
+    lanes->open = 0;
+    lanes->retries = retries;
+    lanes->failed = 0;
+    return lanes;
+}
+
+
+/**
+ * Free the lanes of a download
+ * @param lanes - Pointer to the lanes to free
+ */
+void lanes_free(Lanes *lanes) {
+    free(lanes);
+}
+
+
+/**
+ * Count a lane as open. Every lane is opened before any of them starts, so
+ * none retires thinking it is the last while others are still to come.
+ * @param lanes - Pointer to the lanes
+ */
+void lanes_open(Lanes *lanes) {
+    __atomic_add_fetch(&lanes->open, 1, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Record a chunk that failed, putting it back to be carved again while
+ * retries last, or counting it as failed for good
+ * @param lanes - Pointer to the lanes
+ * @param start - The first byte of the chunk
+ * @param end - One past the last byte of the chunk
+ * @param retry - Whether the chunk can be fetched again at all
+ */
+void lanes_fail(Lanes *lanes, off_t start, off_t end, int retry) {
+    if (retry && __atomic_fetch_sub(&lanes->retries, 1, __ATOMIC_RELAXED) > 0) {
+        range_set_add(lanes->remaining, start, end);
+    }
+    else {
+        __atomic_add_fetch(&lanes->failed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+/**
+ * Retire a lane that found nothing left to carve
+ * @param lanes - Pointer to the lanes
+ * @return 1 if it was the last lane open, and so finalizes the download,
+ *         0 otherwise
+ */
+int lanes_retire(Lanes *lanes) {
+    // the last lane sees everything the others wrote before retiring
+    return __atomic_sub_fetch(&lanes->open, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+
+/**
+ * Get the number of chunks that failed for good
+ * @param lanes - Pointer to the lanes
+ * @return The number of chunks
+ */
+int lanes_failed(Lanes *lanes) {
+    return __atomic_load_n(&lanes->failed, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,72 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include <sys/types.h>
+
+#include "ranges.h"
+
+
+/*
+ * Lanes - the tasks carving the chunks of one download off a range set,
+ * each fetching one chunk at a time on whichever worker it is queued to.
+ * A chunk that fails is put back to be carved again while retries last.
+ * The lane that retires last is the one to finalize the download, so no
+ * thread has to wait on the others. Lanes may be shared between threads.
+ */
+typedef struct LanesStruct Lanes;
+
+
+/**
+ * Allocate the lanes of a download, with none open yet
+ * @param remaining - The ranges of the download not handed out yet, which
+ *                    the lanes carve chunks off. Not owned by the lanes.
+ * @param retries - The most failed chunks put back to be fetched again
+ * @return lanes - Pointer to the lanes
+ */
+Lanes *lanes_alloc(RangeSet *remaining, int retries);
+
+
+/**
+ * Free the lanes of a download
+ * @param lanes - Pointer to the lanes to free
+ */
+void lanes_free(Lanes *lanes);
+
+
+/**
+ * Count a lane as open. Every lane is opened before any of them starts, so
+ * none retires thinking it is the last while others are still to come.
+ * @param lanes - Pointer to the lanes
+ */
+void lanes_open(Lanes *lanes);
+
+
+/**
+ * Record a chunk that failed, putting it back to be carved again while
+ * retries last, or counting it as failed for good
+ * @param lanes - Pointer to the lanes
+ * @param start - The first byte of the chunk
+ * @param end - One past the last byte of the chunk
+ * @param retry - Whether the chunk can be fetched again at all
+ */
+void lanes_fail(Lanes *lanes, off_t start, off_t end, int retry);
+
+
+/**
+ * Retire a lane that found nothing left to carve
+ * @param lanes - Pointer to the lanes
+ * @return 1 if it was the last lane open, and so finalizes the download,
+ *         0 otherwise
+ */
+int lanes_retire(Lanes *lanes);
+
+
+/**
+ * Get the number of chunks that failed for good
+ * @param lanes - Pointer to the lanes
+ * @return The number of chunks
+ */
+int lanes_failed(Lanes *lanes);
+
+
+#endif
@@ -0,0 +1,1760 @@
+#include "libdownloader.h"
+#include "http.h"
+#include "queue.h"
+#include "pqueue.h"
+#include "writer.h"
+#include "cache.h"
+#include "file.h"
+#include "url.h"
+#include "planner.h"
+#include "mirror.h"
+#include "ranges.h"
+#include "lanes.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#define PATH_SIZE 4096
+#define MERGE_BUF_SIZE 65536
+
+// Bytes of completed chunks to let accumulate before an msync of the mapping
+#define MMAP_SYNC_BYTES (8 * 1024 * 1024)
+
+// The most mirrors a chunk is tried on before it fails
+#define MIRROR_ATTEMPTS 4
+
+// Failed chunks a download fetches again before giving up on them
+#define CHUNK_RETRIES 4
+
+// How long a download without a deadline may wait, per step of priority
+// below DL_PRIORITY_MAX. Its chunks are then due, so even background
+// downloads keep moving while urgent ones are queued.
+#define PRIORITY_SLACK_MS 1000
+
+typedef struct DirectFileStruct DirectFile;
+
+typedef struct {
+    char *url;
+    off_t min_range;
+    off_t max_range;
+    Buffer *result;
+
+    char *output;           // Slice of a mapped file to read into, NULL to buffer
+    size_t output_length;   // Size of the output slice
+    ssize_t received;       // Bytes read into output, -1 on failure
+
+    int output_fd;          // File the writer stage writes to, -1 if none
+    Queue *done;            // Where the task is handed back once done
+
+    int stream;             // Decode the response straight into output_fd
+    int prefetched;         // result holds content the planner already received
+    MirrorSet *mirrors;     // Origins to fetch the range from, NULL for url
+    long deadline;          // When the download is wanted by, chunks due first are fetched first
+    DirectFile *direct;     // The output the worker writes into itself, NULL to hand the task back
+    long queued;            // When the task was last queued, for tracing
+}  Task;
+
+
+// An output file mapped into memory so workers can read straight into it
+typedef struct {
+    int fd;
+    char *base;
+    size_t size;
+    size_t unsynced;        // Updated by every worker writing into the mapping
+} MappedFile;
+
+
+/*
+ * An output file the workers write chunks into themselves. Each task
+ * carves its next chunk off the remaining ranges, and the worker that
+ * retires the last task finalizes the file, so no thread collects chunks.
+ */
+struct DirectFileStruct {
+    Plan *plan;
+    RangeSet *remaining;    // Ranges not handed out yet
+
+    int fd;
+    MappedFile *file;       // The mapped output, NULL to write with pwrite
+    char temp[PATH_SIZE];   // Written to, then renamed to path once complete
+    const char *path;
+
+    Lanes *lanes;           // The tasks carving chunks off remaining
+    int failed;             // Whether it failed, once finalized
+
+    Queue *done;            // Gets the file once it is finalized
+};
+
+
+// The workers fetching chunks for every download of an engine
+typedef struct {
+    PriorityQueue *todo;    // Chunks of every download, earliest deadline first
+
+    pthread_t *threads;
+    int num_workers;
+
+    Writer *writer;     // Writer stage, NULL when downloads write their own chunks
+
+} Context;
+
+
+/**
+ * Queue a task for the workers, earliest deadline first
+ */
+static void queue_task(Context *context, Task *task) {
+    task->queued = trace_now();
+    pqueue_put(context->todo, task, task->deadline);
+}
+
+/**
+ * Called by the writer stage once a task's content has been written.
+ * Frees the response and hands the task back to its download.
+ */
+static void task_written(void *arg, ssize_t written) {
+    Task *task = (Task *)arg;
+
+    task->received = written;
+    buffer_free(task->result);
+    task->result = NULL;
+
+    task->queued = trace_now();
+    queue_put(task->done, task);
+}
+
+
+/**
+ * Sink for decoded content, appending it to the task's output file.
+ * @return 0 on success, -1 on failure
+ */
+static int write_decoded(void *arg, const char *data, size_t length) {
+    Task *task = (Task *)arg;
+
+    while (length > 0) {
+        ssize_t written = write(task->output_fd, data, length);
+
+        if (written == -1) {
+            perror("write");
+            return -1;
+        }
+
+        data += written;
+        length -= written;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Get the content of a task's response
+ * @param task - A task with a result
+ * @param length - Filled with the length of the content
+ * @return The content, an offset into the result
+ */
+static char *task_content(Task *task, size_t *length) {
+    if (task->prefetched) {
+        *length = task->result->length;
+        return task->result->data;
+    }
+
+    char *data = http_get_content(task->result);
+    *length = task->result->length - (data - task->result->data);
+    return data;
+}
+
+
+/**
+ * Check a task's response is the chunk it asked for. An error page, a
+ * range the server did not honour, or a response cut short is not.
+ * @param task - A task with a result
+ * @param length - The length of the content of the result
+ * @return 1 if it is the chunk, 0 otherwise
+ */
+static int chunk_valid(Task *task, size_t length) {
+    int ranged = task->max_range >= task->min_range;
+
+    if (task->prefetched) {
+        return 1;
+    }
+
+    return http_get_status(task->result) == (ranged ? 206 : 200) &&
+            (ranged ? length == task->output_length : http_get_complete(task->result));
+}
+
+
+/**
+ * Fetch a task's range from the origin expected to finish it soonest. If
+ * that origin fails, the range is moved to another.
+ */
+static void fetch_mirrored(Task *task, const char *range) {
+    struct timespec start, end;
+    int mirror = -1;
+
+    task->received = -1;
+
+    for (int attempt = 0; attempt < MIRROR_ATTEMPTS &&
+            (mirror = mirror_pick(task->mirrors, mirror)) != -1; ++attempt) {
+        const char *url = mirror_url(task->mirrors, mirror);
+        ssize_t received = -1;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        if (task->output) {
+            received = http_url_into(url, range, task->output, task->output_length);
+        }
+        else if ((task->result = http_url(url, range)) != NULL) {
+            size_t length = 0;
+            task_content(task, &length);
+
+            if (chunk_valid(task, length)) {
+                received = length;
+            }
+            else {
+                buffer_free(task->result);
+                task->result = NULL;
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if (received != (ssize_t)task->output_length) {
+            fprintf(stderr, "error downloading %s from mirror %s\n", range, url);
+            mirror_done(task->mirrors, mirror, -1, 0);
+            continue;
+        }
+
+        mirror_done(task->mirrors, mirror, received, (end.tv_sec - start.tv_sec) +
+                (end.tv_nsec - start.tv_nsec) / 1e9);
+        task->received = received;
+        return;
+    }
+}
+
+
+static void direct_written(Context *context, Task *task);
+static void count_chunk(Plan *plan, ssize_t received);
+
+
+static void *worker_thread(void *arg) {
+    Context *context = (Context *)arg;
+
+    trace_thread_name("worker");
+
+    Task *task = (Task *)pqueue_get(context->todo);
+    char *range = (char *)malloc(1024 * sizeof(char));
+    
+    while (task) {
+        // a negative max_range asks for the whole resource without a range
+        if (task->max_range >= task->min_range) {
+            snprintf(range, 1024 * sizeof(char), "%lld-%lld", (long long)task->min_range, 
+            (long long)task->max_range);
+        }
+        else {
+            range[0] = '\0';
+        }
+
+        trace_label("%s %s", task->url, range);
+        trace_span("todo", task->queued);
+
+        long start = trace_now();
+    
+        if (task->prefetched) {
+            // the planner already received this chunk
+            if (task->output) {
+                memcpy(task->output, task->result->data, task->output_length);
+                task->received = task->output_length;
+            }
+        }
+        else if (task->mirrors) {
+            fetch_mirrored(task, range);
+        }
+        else if (task->output) {
+            task->received = http_url_into(task->url, range, task->output,
+            task->output_length);
+        }
+        else if (task->stream) {
+            task->received = http_url_stream(task->url, range, write_decoded, task);
+        }
+        else {
+            task->result = http_url(task->url, range);
+        }
+
+        trace_span("fetch", start);
+
+        if (task->direct) {
+            // written in place by this thread, nothing to hand back
+            direct_written(context, task);
+
+            task = (Task *)pqueue_get(context->todo);
+            continue;
+        }
+
+        if (task->result && task->output_fd != -1) {
+            size_t length = 0;
+            char *data = task_content(task, &length);
+
+            if (chunk_valid(task, length)) {
+                // blocks here if the writer stage is over its memory budget
+                writer_submit(context->writer, task->output_fd, task->min_range,
+                data, length, task_written, task);
+
+                task = (Task *)pqueue_get(context->todo);
+                continue;
+            }
+
+            // handed back as failed, to be fetched again
+            buffer_free(task->result);
+            task->result = NULL;
+            task->received = -1;
+        }
+
+        task->queued = trace_now();
+        queue_put(task->done, task);
+        task = (Task *)pqueue_get(context->todo);
+    }
+    
+    free(range);
+    return NULL;
+}
+
+
+static Context *spawn_workers(int num_workers, Writer *writer, ThreadOptions *options) {
+    Context *context = (Context*)malloc(sizeof(Context));
+    context->writer = writer;
+
+    // every chunk of the active downloads is queued at once, so that an
+    // urgent download never waits for room behind a bulk one
+    context->todo = pqueue_alloc(0);
+
+    context->num_workers = num_workers;
+
+    context->threads = (pthread_t*)malloc(sizeof(pthread_t) * num_workers);
+    int i = 0;
+
+    for (i = 0; i < num_workers; ++i) {
+        thread_create(&context->threads[i], options, worker_thread, context);
+    }
+
+    return context;
+}
+
+static void free_workers(Context *context) {
+    int num_workers = context->num_workers;
+    int i = 0;
+
+    for (i = 0; i < num_workers; ++i) {
+        pqueue_put(context->todo, NULL, LONG_MAX);
+    }
+
+    for (i = 0; i < num_workers; ++i) {
+        if (pthread_join(context->threads[i], NULL) != 0) {
+            perror("pthread_join");
+            exit(1);
+        }
+    }
+
+    pqueue_free(context->todo);
+
+    free(context->threads);
+    free(context);
+}
+
+
+static Task *new_task(const char *url, off_t min_range, off_t max_range, Queue *done) {
+    Task *task = malloc(sizeof(Task));
+    task->result = NULL;
+    task->output = NULL;
+    task->output_length = 0;
+    task->received = -1;
+    task->output_fd = -1;
+    task->done = done;
+    task->stream = 0;
+    task->prefetched = 0;
+    task->mirrors = NULL;
+    task->deadline = 0;
+    task->direct = NULL;
+    task->queued = 0;
+    task->url = malloc(strlen(url) + 1);
+    task->min_range = min_range;
+    task->max_range = max_range;
+
+    strcpy(task->url, url);
+
+    return task;
+}
+
+static void free_task(Task *task) {
+
+    if (task->result) {
+        free(task->result->data);
+        free(task->result);
+    }
+
+    free(task->url);
+    free(task);
+}
+
+
+/**
+ * Get the offset of the i-th chunk of a download. When the planner already
+ * received a first chunk, the other chunks split what is left after it.
+ * @param first - The length of the first chunk, 0 if there is none
+ * @param bytes - The maximum size of the other chunks
+ * @param i - The index of the chunk
+ * @return The offset of the chunk
+ */
+static off_t chunk_offset(off_t first, off_t bytes, int i) {
+    if (first > 0) {
+        return i == 0 ? 0 : first + (i - 1) * bytes;
+    }
+
+    return i * bytes;
+}
+
+
+/**
+ * Get a task for the next chunk of a plan. The first task takes over the
+ * content the planner already received, if any, and a plan that is not
+ * split is a single request for the whole resource. Every other chunk is
+ * carved off the ranges still remaining, which always leaves them at the
+ * offsets chunk_offset gives.
+ * @param plan - The plan for the download
+ * @param remaining - The ranges of the download not handed out yet
+ * @param task - A task that is done to reuse, or NULL to create one
+ * @param done - Where the task is handed back once done
+ * @return The task, or NULL (freeing task) if no chunk is left
+ */
+static Task *next_chunk(Plan *plan, RangeSet *remaining, Task *task, Queue *done) {
+    off_t start = 0, end = 0;
+
+    if (plan->first) {
+        task = new_task(plan->url, 0, plan->first_length - 1, done);
+        task->result = plan->first;
+        task->prefetched = 1;
+        task->output_length = plan->first_length;
+        task->deadline = plan->deadline;
+
+        plan->first = NULL;
+        return task;
+    }
+
+    if (plan->first_length == 0 && plan->num_tasks == 1) {
+        if (task) {
+            free_task(task);
+            return NULL;
+        }
+
+        task = new_task(plan->url, 0, -1, done);
+        task->output_length = plan->content_length > 0 ? plan->content_length : 0;
+        task->deadline = plan->deadline;
+        return task;
+    }
+
+    if (range_set_carve(remaining, plan->max_chunk_size, &start, &end) == -1) {
+        if (task) {
+            free_task(task);
+        }
+        return NULL;
+    }
+
+    if (task == NULL) {
+        task = new_task(plan->url, start, end - 1, done);
+    }
+
+    if (task->result) {
+        buffer_free(task->result);
+        task->result = NULL;
+    }
+
+    task->min_range = start;
+    task->max_range = end - 1;
+    task->output_length = end - start;
+    task->received = -1;
+    task->prefetched = 0;
+    task->mirrors = plan->mirrors;
+    task->deadline = plan->deadline;
+    return task;
+}
+
+
+/**
+ * Give a duplicate url the output of an earlier download of the same
+ * resource, by reflink, hardlink or copy.
+ * @param previous - The output path of the earlier download
+ * @param path - The output path of the duplicate
+ * @return 0 on success, -1 on failure
+ */
+static int share_download(const char *previous, const char *path) {
+    if (strcmp(previous, path) == 0) {
+        return 0;
+    }
+
+    unlink(path);
+    return file_clone(previous, path);
+}
+
+
+/**
+ * Create a file of the given size and map it into memory, shared, so that
+ * bytes written to the mapping land in the page cache for the file.
+ * @param filename - The file to create (truncated if it exists)
+ * @param size - The size of the file in bytes, must be greater than 0
+ * @return The mapped file, or NULL on failure
+ */
+static MappedFile *map_output_file(const char *filename, size_t size) {
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+
+    if (fd == -1) {
+        perror("open");
+        return NULL;
+    }
+
+    if (ftruncate(fd, size) == -1) {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+
+    char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return NULL;
+    }
+
+    MappedFile *file = malloc(sizeof(MappedFile));
+    file->fd = fd;
+    file->base = base;
+    file->size = size;
+    file->unsynced = 0;
+
+    return file;
+}
+
+
+/**
+ * Start writeback of the whole mapping, unmap it and close the file.
+ * @param file - The mapped file to free
+ */
+static void unmap_output_file(MappedFile *file) {
+    msync(file->base, file->size, MS_ASYNC);
+    munmap(file->base, file->size);
+    close(file->fd);
+    free(file);
+}
+
+
+/**
+ * Release a completed chunk of a mapped file. Its whole pages are dropped
+ * from our address space (the data stays in the page cache) and every
+ * MMAP_SYNC_BYTES of completed chunks writeback of the mapping is started.
+ * @param file - The mapped file the chunk belongs to
+ * @param offset - Offset of the chunk in the file
+ * @param length - Length of the chunk in bytes
+ */
+static void release_mapped_chunk(MappedFile *file, size_t offset, size_t length) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = (offset + page - 1) / page * page;
+    size_t end = (offset + length) / page * page;
+
+    if (end > start) {
+        madvise(file->base + start, end - start, MADV_DONTNEED);
+    }
+
+    // workers writing into the mapping themselves release chunks at once
+    if (__atomic_add_fetch(&file->unsynced, length, __ATOMIC_RELAXED) >= MMAP_SYNC_BYTES &&
+            __atomic_exchange_n(&file->unsynced, 0, __ATOMIC_RELAXED) >= MMAP_SYNC_BYTES) {
+        msync(file->base, file->size, MS_ASYNC);
+    }
+}
+
+
+// Prepares a task for its chunk before it is queued, e.g. points it into the output
+typedef void (*TaskSetup)(Task *task, void *arg);
+
+// Collects the result of a task once it is done, returning the bytes of its chunk or -1 if it failed
+typedef ssize_t (*TaskResult)(Task *task, void *arg);
+
+
+static void mapped_setup(Task *task, void *arg) {
+    MappedFile *file = (MappedFile *)arg;
+
+    task->output = file->base + task->min_range;
+}
+
+
+static ssize_t mapped_result(Task *task, void *arg) {
+    MappedFile *file = (MappedFile *)arg;
+    size_t offset = task->output - file->base;
+    size_t length = task->output_length;
+
+    if (task->received != length) {
+        fprintf(stderr, "error downloading: %s\n", task->url);
+        return -1;
+    }
+
+    release_mapped_chunk(file, offset, length);
+    return length;
+}
+
+
+static void written_setup(Task *task, void *arg) {
+    task->output_fd = *(int *)arg;
+}
+
+
+static ssize_t written_result(Task *task, void *arg) {
+    if (task->received < 0) {
+        fprintf(stderr, "error downloading: %s\n", task->url);
+        return -1;
+    }
+
+    return task->received;
+}
+
+
+static ssize_t chunked_result(Task *task, void *arg) {
+    const char *prefix = (const char *)arg;
+    char filename[PATH_SIZE];
+    FILE *fp = NULL;
+    ssize_t rc = -1;
+
+    if (task->result) {
+        snprintf(filename, PATH_SIZE, "%s.%lld", prefix, (long long)task->min_range);
+
+        size_t length = 0;
+        char *data = task_content(task, &length);
+
+        if (!chunk_valid(task, length)) {
+            fprintf(stderr, "error downloading: %s\n", task->url);
+        }
+        else if ((fp = fopen(filename, "w")) == NULL) {
+            fprintf(stderr, "error writing to: %s\n", filename);
+        }
+        else {
+            long start = trace_now();
+
+            fwrite(data, 1, length, fp);
+            fclose(fp);
+            trace_span("write", start);
+
+            rc = length;
+        }
+    }
+    else {
+        fprintf(stderr, "error downloading: %s\n", task->url);
+    }
+
+    return rc;
+}
+
+
+/**
+ * Fetch every chunk of a plan with at most one task per worker. Each task
+ * comes back here once its chunk is done and is handed the next chunk
+ * carved off the remaining ranges, so however many chunks a download has,
+ * it only allocates that many tasks. A chunk that fails is put back to be
+ * fetched again, up to CHUNK_RETRIES times per download.
+ * @param context - The workers to fetch with
+ * @param plan - The plan for the download
+ * @param setup - Prepares each task for its chunk, or NULL
+ * @param result - Collects the result of each task
+ * @param arg - Passed to setup and result
+ * @return The number of chunks that failed for good
+ */
+static int fetch_chunks(Context *context, Plan *plan, TaskSetup setup, TaskResult result, void *arg) {
+    int lanes = plan->num_tasks < context->num_workers ? plan->num_tasks : context->num_workers;
+    int active = 0, failed = 0, retries = CHUNK_RETRIES;
+    Queue *done = queue_alloc(lanes);
+    RangeSet *remaining = range_set_alloc(plan->first_length, plan->content_length);
+    Task *task = NULL;
+
+    while (active < lanes && (task = next_chunk(plan, remaining, NULL, done)) != NULL) {
+        if (setup) {
+            setup(task, arg);
+        }
+        queue_task(context, task);
+        ++active;
+    }
+
+    while (active > 0) {
+        task = (Task *)queue_get(done);
+        trace_span("done", task->queued);
+
+        ssize_t received = result(task, arg);
+        count_chunk(plan, received);
+
+        if (received == -1) {
+            if (task->max_range >= task->min_range && !task->prefetched && retries > 0) {
+                --retries;
+                range_set_add(remaining, task->min_range, task->max_range + 1);
+            }
+            else {
+                ++failed;
+            }
+        }
+
+        if ((task = next_chunk(plan, remaining, task, done)) != NULL) {
+            if (setup) {
+                setup(task, arg);
+            }
+            queue_task(context, task);
+        }
+        else {
+            --active;
+        }
+    }
+
+    range_set_free(remaining);
+    queue_free(done);
+    return failed;
+}
+
+
+/**
+ * Merge the chunk files of a download into the output file synchronously
+ * by reading each file, and writing its contents to the dest file.
+ * @param dest - char pointer to name of file resulting from merge. The
+ *               chunk files are named after it, with their offset appended
+ * @param first - The byte size of the first chunk, 0 if all are bytes long
+ * @param bytes - The maximum byte size downloaded
+ * @param tasks - The tasks needed for the multipart download
+ * @return 0 on success, -1 if a chunk is missing or the output file could
+ *         not be written
+ */
+static int merge_files(const char *dest, off_t first, off_t bytes, int tasks) {
+    char filename[PATH_SIZE];
+    size_t n = 0;
+    int rc = 0;
+
+    FILE *out = fopen(dest, "w");
+    if (out == NULL) {
+        fprintf(stderr, "error writing to: %s\n", dest);
+        return -1;
+    }
+
+    char *buf = (char *)malloc(MERGE_BUF_SIZE);
+
+    for (int i = 0; i < tasks && rc == 0; ++i) {
+        snprintf(filename, PATH_SIZE, "%s.%lld", dest, (long long)chunk_offset(first, bytes, i));
+        FILE *in = fopen(filename, "r");
+
+        // the output would be short, so it is not the file
+        if (in == NULL) {
+            fprintf(stderr, "missing chunk: %s\n", filename);
+            rc = -1;
+            break;
+        }
+
+        while ((n = fread(buf, 1, MERGE_BUF_SIZE, in)) > 0) {
+            if (fwrite(buf, 1, n, out) != n) {
+                fprintf(stderr, "error writing to: %s\n", dest);
+                rc = -1;
+                break;
+            }
+        }
+
+        fclose(in);
+    }
+
+    if (fclose(out) != 0) {
+        fprintf(stderr, "error writing to: %s\n", dest);
+        rc = -1;
+    }
+
+    free(buf);
+    return rc;
+}
+
+
+/**
+ * Remove files caused by chunk downloading
+ * @param dest - The output file the chunk files are named after
+ * @param first - The byte size of the first chunk, 0 if all are bytes long
+ * @param bytes - The maximum byte size per file. Assumed to be filename
+ * @param files - The number of chunked files to remove.
+ */
+static void remove_chunk_files(const char *dest, off_t first, off_t bytes, int files) {
+    char filename[PATH_SIZE];
+
+    for (int i = 0; i < files; ++i) {
+        snprintf(filename, PATH_SIZE, "%s.%lld", dest, (long long)chunk_offset(first, bytes, i));
+        unlink(filename);
+    }
+}
+
+
+/**
+ * Download a url into chunk files next to the output file, written by the
+ * thread running the download, then merge them into the output file.
+ * @return The number of chunks that failed to download, or -1 if they
+ *         could not be merged
+ */
+static int download_chunked(Context *context, Plan *plan, const char *filename) {
+    int failed = fetch_chunks(context, plan, NULL, chunked_result, (void *)filename);
+
+    /* Merge the files -- simple synchronous method
+     * Then remove the chunked download files
+     * Beware, this is not an efficient method
+     */
+    long start = trace_now();
+
+    if (merge_files(filename, plan->first_length, plan->max_chunk_size, plan->num_tasks) == -1) {
+        failed = -1;
+    }
+    remove_chunk_files(filename, plan->first_length, plan->max_chunk_size, plan->num_tasks);
+    trace_span("merge", start);
+
+    return failed;
+}
+
+
+/**
+ * Download a url by reading each chunk straight into a memory mapping of
+ * the output file.
+ * @return -1 if the file could not be mapped, otherwise the number of
+ *         chunks that failed to download
+ */
+static int download_mapped(Context *context, Plan *plan, const char *filename) {
+    MappedFile *file = map_output_file(filename, plan->content_length);
+    int failed = 0;
+
+    if (file == NULL) {
+        return -1;
+    }
+
+    failed = fetch_chunks(context, plan, mapped_setup, mapped_result, file);
+
+    unmap_output_file(file);
+    return failed;
+}
+
+
+/**
+ * Download a url, handing each chunk to the writer stage which writes it
+ * into place in the output file. The thread running the download only
+ * collects results.
+ * @return -1 if the output file could not be opened, otherwise the number
+ *         of chunks that failed to download
+ */
+static int download_written(Context *context, Plan *plan, const char *filename) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    int failed = 0;
+
+    if (fd == -1) {
+        perror("open");
+        return -1;
+    }
+
+    // sized up front but sparse, so chunks land in place in any order
+    // without extending the file and no blocks are allocated until written
+    if (plan->content_length > 0 && ftruncate(fd, plan->content_length) == -1) {
+        perror("ftruncate");
+        close(fd);
+        return -1;
+    }
+
+    failed = fetch_chunks(context, plan, written_setup, written_result, &fd);
+
+    close(fd);
+    return failed;
+}
+
+
+/**
+ * Download a url as a single stream, decoding any content-coding on the
+ * worker as it arrives and writing the result to the output file.
+ * @return -1 if the output file could not be opened, 1 if the download
+ *         failed, otherwise 0
+ */
+static int download_streamed(Context *context, Plan *plan, const char *filename) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    if (fd == -1) {
+        perror("open");
+        return -1;
+    }
+
+    Queue *done = queue_alloc(1);
+    Task *task = new_task(plan->url, 0, -1, done);
+    task->output_fd = fd;
+    task->stream = 1;
+    task->deadline = plan->deadline;
+    queue_task(context, task);
+
+    task = (Task *)queue_get(done);
+    trace_span("done", task->queued);
+
+    ssize_t received = written_result(task, NULL);
+    count_chunk(plan, received);
+
+    int failed = received < 0 ? 1 : 0;
+
+    free_task(task);
+    queue_free(done);
+    close(fd);
+    return failed;
+}
+
+
+/**
+ * Write all of a chunk at its offset in a file
+ * @return 0 on success, -1 on failure
+ */
+static int write_at(int fd, const char *data, size_t length, off_t offset) {
+    while (length > 0) {
+        ssize_t written = pwrite(fd, data, length, offset);
+
+        if (written == -1) {
+            perror("pwrite");
+            return -1;
+        }
+
+        data += written;
+        length -= written;
+        offset += written;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Finalize a direct output once its last task is retired: get the data to
+ * disk and move the file into place, or remove it if any chunk failed.
+ * Runs on the worker that retired the last task.
+ */
+static void finalize_direct(DirectFile *direct) {
+    int failed = lanes_failed(direct->lanes);
+    long start = trace_now();
+
+    // dirty pages of the mapping are written back by fdatasync on the file
+    if (direct->file) {
+        munmap(direct->file->base, direct->file->size);
+        free(direct->file);
+        direct->file = NULL;
+    }
+
+    // the data is on disk before the file appears under its name
+    if (failed == 0 && fdatasync(direct->fd) == -1) {
+        perror("fdatasync");
+        failed = 1;
+    }
+
+    close(direct->fd);
+
+    if (failed == 0 && rename(direct->temp, direct->path) == -1) {
+        perror("rename");
+        failed = 1;
+    }
+
+    if (failed) {
+        unlink(direct->temp);
+    }
+
+    trace_span("finalize", start);
+
+    direct->failed = failed;
+    queue_put(direct->done, direct);
+}
+
+
+/**
+ * Called on a worker once it has fetched a chunk of a direct output. The
+ * chunk is written in place and the task is given the next chunk, or
+ * retired if none is left.
+ */
+static void direct_written(Context *context, Task *task) {
+    DirectFile *direct = task->direct;
+    int written = 0;
+
+    if (direct->file) {
+        written = task->received == (ssize_t)task->output_length;
+    }
+    else if (task->result) {
+        size_t length = 0;
+        char *data = task_content(task, &length);
+        long start = trace_now();
+
+        written = chunk_valid(task, length) &&
+                write_at(direct->fd, data, length, task->min_range) == 0;
+        trace_span("write", start);
+    }
+
+    count_chunk(direct->plan, written ? (ssize_t)task->output_length : -1);
+
+    if (written) {
+        if (direct->file) {
+            release_mapped_chunk(direct->file, task->min_range, task->output_length);
+        }
+    }
+    else {
+        fprintf(stderr, "error downloading: %s\n", task->url);
+
+        // the content the planner received cannot be fetched again
+        lanes_fail(direct->lanes, task->min_range, task->max_range + 1, !task->prefetched);
+    }
+
+    if ((task = next_chunk(direct->plan, direct->remaining, task, NULL)) != NULL) {
+        if (direct->file) {
+            task->output = direct->file->base + task->min_range;
+        }
+
+        queue_task(context, task);
+        return;
+    }
+
+    if (lanes_retire(direct->lanes)) {
+        finalize_direct(direct);
+    }
+}
+
+
+/**
+ * Download a url with each worker writing the chunks it fetches straight
+ * into the output file, through a mapping if use_mmap is set, and carving
+ * its next chunk itself. The thread running the download only waits for
+ * the file to be finalized, rather than collecting every chunk.
+ * @return -1 if the output file could not be created, otherwise the
+ *         number of chunks that failed to download
+ */
+static int download_direct(Context *context, Plan *plan, const char *filename, int use_mmap) {
+    int max_lanes = plan->num_tasks < context->num_workers ? plan->num_tasks : context->num_workers;
+    int count = 0;
+    DirectFile direct;
+
+    direct.plan = plan;
+    direct.path = filename;
+    direct.file = NULL;
+    direct.failed = 0;
+    snprintf(direct.temp, PATH_SIZE, "%s.part", filename);
+
+    if (use_mmap) {
+        if ((direct.file = map_output_file(direct.temp, plan->content_length)) == NULL) {
+            unlink(direct.temp);
+            return -1;
+        }
+
+        direct.fd = direct.file->fd;
+    }
+    else {
+        direct.fd = open(direct.temp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+        // sparse until the chunks land in place
+        if (direct.fd == -1 || ftruncate(direct.fd, plan->content_length) == -1) {
+            perror(direct.temp);
+            if (direct.fd != -1) {
+                close(direct.fd);
+                unlink(direct.temp);
+            }
+            return -1;
+        }
+    }
+
+    direct.remaining = range_set_alloc(plan->first_length, plan->content_length);
+    direct.lanes = lanes_alloc(direct.remaining, CHUNK_RETRIES);
+    direct.done = queue_alloc(1);
+
+    // every task is counted before any is queued, so none finalizes early
+    Task **tasks = (Task **)malloc(sizeof(Task *) * max_lanes);
+
+    while (count < max_lanes && (tasks[count] = next_chunk(plan, direct.remaining, NULL, NULL)) != NULL) {
+        tasks[count]->direct = &direct;
+        lanes_open(direct.lanes);
+
+        if (direct.file) {
+            tasks[count]->output = direct.file->base + tasks[count]->min_range;
+        }
+
+        ++count;
+    }
+
+    if (count == 0) {
+        finalize_direct(&direct);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        queue_task(context, tasks[i]);
+    }
+
+    free(tasks);
+
+    queue_get(direct.done);
+
+    queue_free(direct.done);
+    lanes_free(direct.lanes);
+    range_set_free(direct.remaining);
+    return direct.failed;
+}
+
+
+struct DlEngineStruct {
+    DlConfig config;
+
+    Context *context;
+    Writer *writer;
+    Cache *cache;
+    Planner *planner;
+
+    pthread_t *coordinators;    // Each runs one download at a time
+
+    pthread_mutex_t lock;
+    UrlTable *downloads;        // The FirstDownload of each url, if dedup
+    const char **running;       // The output path of each download running or being shared, NULL for a free slot
+    pthread_cond_t path_free;   // Signalled when a download stops running
+};
+
+
+// What is kept of the first download of a url, for its duplicates. Once it
+// is done only the path of its output is kept, so that the table stays
+// small however many urls go through the engine.
+typedef struct {
+    DlDownload *running;        // The download while it is planned or running, NULL once done
+    char *path;                 // Its output once it succeeded, NULL otherwise
+} FirstDownload;
+
+
+struct DlDownloadStruct {
+    char *url;
+    char *path;
+    long deadline;              // When it is due, in ms of the monotonic clock
+    int strict;                 // Whether the deadline was asked for
+
+    DlCallback callback;
+    void *arg;
+
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    int status;                 // DL_PENDING until done
+    int holders;                // The engine and/or the caller
+
+    FirstDownload *first;       // Its entry in the engine's url table, if it is the first of its url
+    DlDownload *waiting;        // Duplicates of its url waiting for it, linked through next
+    DlDownload *next;
+
+    DlResult result;            // Filled in as it runs, by several workers at once in direct mode
+};
+
+
+/**
+ * Drop a hold on a download, freeing it when nobody holds it.
+ */
+static void release_download(DlDownload *download) {
+    pthread_mutex_lock(&download->lock);
+    int holders = --download->holders;
+    pthread_mutex_unlock(&download->lock);
+
+    if (holders == 0) {
+        for (int i = 0; i < download->result.num_mirrors; ++i) {
+            free((char *)download->result.mirrors[i].url);
+        }
+
+        free(download->result.mirrors);
+        pthread_mutex_destroy(&download->lock);
+        pthread_cond_destroy(&download->finished);
+        free(download->url);
+        free(download->path);
+        free(download);
+    }
+}
+
+
+/**
+ * The monotonic clock in ms, which deadlines are measured on.
+ */
+static long now_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000;
+}
+
+
+/**
+ * Count a chunk towards the result of the download it belongs to. May be
+ * called from several workers at once.
+ * @param plan - The plan of the download
+ * @param received - The bytes of the chunk, -1 if it failed
+ */
+static void count_chunk(Plan *plan, ssize_t received) {
+    DlResult *result = &((DlDownload *)plan->arg)->result;
+
+    if (received < 0) {
+        __atomic_add_fetch(&result->failed_chunks, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_add_fetch(&result->chunks, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&result->bytes, received, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Keep how much each origin of a mirrored download contributed in its result
+ */
+static void record_mirrors(DlDownload *download, MirrorSet *mirrors) {
+    int count = mirror_count(mirrors);
+    DlMirrorResult *results = (DlMirrorResult *)calloc(count, sizeof(DlMirrorResult));
+
+    for (int i = 0; i < count; ++i) {
+        results[i].url = strdup(mirror_url(mirrors, i));
+        results[i].dropped = mirror_stats(mirrors, i, &results[i].chunks, &results[i].bytes,
+                &results[i].rate);
+    }
+
+    download->result.mirrors = results;
+    download->result.num_mirrors = count;
+}
+
+
+/**
+ * Free an entry of the engine's url table
+ */
+static void free_first_download(void *value) {
+    FirstDownload *first = (FirstDownload *)value;
+
+    free(first->path);
+    free(first);
+}
+
+
+/**
+ * Check whether a download to a path is running. Called with the engine
+ * locked.
+ */
+static int path_running(DlEngine *engine, const char *path) {
+    for (int i = 0; i < engine->config.max_active; ++i) {
+        if (engine->running[i] && strcmp(engine->running[i], path) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Find a slot no download is running in. Called with the engine locked.
+ * @return The slot, or -1 if every one is taken
+ */
+static int free_slot(DlEngine *engine) {
+    for (int i = 0; i < engine->config.max_active; ++i) {
+        if (engine->running[i] == NULL) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+/**
+ * Mark a download to a path as running, first waiting for any download
+ * already running to the same path, so two never write one file at once.
+ * @return The slot the path is held in, for release_path
+ */
+static int claim_path(DlEngine *engine, const char *path) {
+    int slot = 0;
+
+    pthread_mutex_lock(&engine->lock);
+
+    // there is a slot for every coordinator, but a duplicate being given
+    // its output takes one too, so there may be none free for a while
+    while (path_running(engine, path) || (slot = free_slot(engine)) == -1) {
+        pthread_cond_wait(&engine->path_free, &engine->lock);
+    }
+
+    engine->running[slot] = path;
+    pthread_mutex_unlock(&engine->lock);
+
+    return slot;
+}
+
+
+/**
+ * Mark the download held in a slot by claim_path as no longer running
+ */
+static void release_path(DlEngine *engine, int slot) {
+    pthread_mutex_lock(&engine->lock);
+    engine->running[slot] = NULL;
+    pthread_cond_broadcast(&engine->path_free);
+    pthread_mutex_unlock(&engine->lock);
+}
+
+
+/**
+ * Give a duplicate the output of an earlier download, claiming its path
+ * as run_download's caller does, so a download running to the same path
+ * is not clobbered.
+ * @return 0 on success, -1 on failure
+ */
+static int share_claimed(DlEngine *engine, const char *previous, const char *path) {
+    int slot = claim_path(engine, path);
+    int status = share_download(previous, path);
+
+    release_path(engine, slot);
+    return status;
+}
+
+
+/**
+ * Mark a download as done, wake anyone waiting for it and call its
+ * callback. Duplicates waiting for it are given its output.
+ */
+static void finish_download(DlEngine *engine, DlDownload *download, int status) {
+    long late = now_ms() - download->deadline;
+
+    if (download->strict && late > 0) {
+        download->result.late_ms = late;
+    }
+
+    download->result.status = status;
+
+    pthread_mutex_lock(&download->lock);
+    download->status = status;
+    pthread_cond_broadcast(&download->finished);
+    pthread_mutex_unlock(&download->lock);
+
+    if (download->callback) {
+        download->callback(download, status, download->arg);
+    }
+
+    // taken once the status is set, so no duplicate is left waiting, and the
+    // url's entry keeps just the path from now on
+    pthread_mutex_lock(&engine->lock);
+    DlDownload *waiting = download->waiting;
+    download->waiting = NULL;
+
+    if (download->first) {
+        download->first->running = NULL;
+        download->first->path = status == 0 ? strdup(download->path) : NULL;
+        download->first = NULL;
+    }
+    pthread_mutex_unlock(&engine->lock);
+
+    while (waiting) {
+        DlDownload *next = waiting->next;
+
+        waiting->result.source = DL_SOURCE_DUPLICATE;
+        finish_download(engine, waiting, status == 0 ? share_claimed(engine, download->path, waiting->path) : -1);
+        waiting = next;
+    }
+
+    release_download(download);
+}
+
+
+/**
+ * Check for an earlier download of the same url (or an equivalent one).
+ * A duplicate of a download still planned or running waits for it, and
+ * one of a download that is done shares its output at once.
+ * @param url - The url of the download, without mirrors
+ * @return 1 if the download was a duplicate, 0 if it is the first of its
+ *         url (or the earlier one failed) so it should be run
+ */
+static int attach_duplicate(DlEngine *engine, DlDownload *download, const char *url) {
+    pthread_mutex_lock(&engine->lock);
+    FirstDownload *first = (FirstDownload *)url_table_get(engine->downloads, url);
+
+    if (first && first->running) {
+        download->next = first->running->waiting;
+        first->running->waiting = download;
+        pthread_mutex_unlock(&engine->lock);
+        return 1;
+    }
+
+    // the first download of the url, or a retry of one that failed
+    if (first == NULL || first->path == NULL) {
+        if (first == NULL) {
+            first = (FirstDownload *)malloc(sizeof(FirstDownload));
+            first->path = NULL;
+            url_table_put(engine->downloads, url, first);
+        }
+
+        first->running = download;
+        download->first = first;
+        pthread_mutex_unlock(&engine->lock);
+        return 0;
+    }
+
+    pthread_mutex_unlock(&engine->lock);
+
+    // the path of a download that succeeded is never changed, so it is safe
+    // to use unlocked
+    download->result.source = DL_SOURCE_DUPLICATE;
+    finish_download(engine, download, share_claimed(engine, first->path, download->path));
+    return 1;
+}
+
+
+/**
+ * Move a download's output into place once every chunk of it is in, or
+ * remove it if any failed, so an incomplete file never appears under the
+ * output path.
+ * @param temp - The file the download was written to
+ * @param path - The output path
+ * @param failed - What the download returned, 0 if it is complete
+ * @return 0 if the output is in place, -1 otherwise
+ */
+static int commit_output(const char *temp, const char *path, int failed) {
+    if (failed == 0 && rename(temp, path) == 0) {
+        return 0;
+    }
+
+    if (failed == 0) {
+        perror("rename");
+    }
+
+    unlink(temp);
+    return -1;
+}
+
+
+/**
+ * Download a planned url to a path, choosing how from the engine's config.
+ * @return 0 on success, -1 on failure
+ */
+static int run_download(DlEngine *engine, Plan *plan, const char *path) {
+    DlDownload *download = (DlDownload *)plan->arg;
+    DlConfig *config = &engine->config;
+    char temp[PATH_SIZE];
+    int failed = -1;
+
+    if (plan->num_tasks == 0) {
+        if (cache_link(engine->cache, plan->url, path) == 0) {
+            download->result.source = DL_SOURCE_CACHE;
+            return 0;
+        }
+
+        plan->num_tasks = http_plan(plan->url, config->num_workers, NULL, &plan->current,
+                &plan->max_chunk_size, &plan->content_length);
+    }
+
+    // a failed download leaves no file behind rather than the old one
+    unlink(path);
+    failed = -1;
+
+    // ranged downloads can have every chunk written by the worker fetching
+    // it, and the last one moves the file into place itself
+    if (config->direct && plan->content_length > 0 &&
+            (plan->first_length > 0 || plan->num_tasks > 1)) {
+        failed = download_direct(engine->context, plan, path, config->use_mmap);
+    }
+
+    // otherwise the download is written next to the output, and only moved
+    // into place once it is complete
+    if (failed == -1) {
+        snprintf(temp, PATH_SIZE, "%s.part", path);
+
+        // compressed or unsplittable content is a single stream, written to
+        // the file as it arrives rather than held in memory whatever its size
+        if (plan->num_tasks == 1 && (config->decode || (plan->first == NULL && plan->mirrors == NULL))) {
+            failed = download_streamed(engine->context, plan, temp);
+        }
+
+        if (failed == -1 && config->use_mmap && plan->content_length > 0) {
+            failed = download_mapped(engine->context, plan, temp);
+        }
+
+        if (failed == -1 && engine->writer) {
+            failed = download_written(engine->context, plan, temp);
+        }
+
+        if (failed == -1) {
+            failed = download_chunked(engine->context, plan, temp);
+        }
+
+        failed = commit_output(temp, path, failed);
+    }
+
+    if (plan->mirrors) {
+        record_mirrors(download, plan->mirrors);
+    }
+
+    if (engine->cache && failed == 0) {
+        cache_store(engine->cache, plan->url, path, &plan->current);
+    }
+
+    return failed == 0 ? 0 : -1;
+}
+
+
+static void *coordinator_thread(void *arg) {
+    DlEngine *engine = (DlEngine *)arg;
+    Plan *plan = NULL;
+
+    trace_thread_name("download");
+
+    while ((plan = planner_next(engine->planner)) != NULL) {
+        DlDownload *download = (DlDownload *)plan->arg;
+        long start = trace_now();
+
+        trace_label("%s", plan->url);
+        int slot = claim_path(engine, download->path);
+        int status = run_download(engine, plan, download->path);
+        release_path(engine, slot);
+        trace_span("download", start);
+
+        plan_free(plan);
+        finish_download(engine, download, status);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Fill a config with the defaults
+ * @param config - The config to fill
+ */
+void dl_config_init(DlConfig *config) {
+    memset(config, 0, sizeof(DlConfig));
+
+    config->num_workers = 8;
+    config->num_planners = 2;
+    config->plan_depth = 64;
+    config->max_active = 1;
+    config->first_size = 256 * 1024;
+    config->writer_budget = 64 * 1024 * 1024;
+    config->writer_sync = 4 * 1024 * 1024;
+    config->cache_size = (size_t)1024 * 1024 * 1024;
+}
+
+
+/**
+ * Create an engine and start its threads. Whether compressed content is
+ * accepted is set for the whole process.
+ * @param config - How to download, copied into the engine
+ * @return engine - Pointer to the engine or NULL on failure
+ */
+DlEngine *dl_engine_create(const DlConfig *config) {
+    Cache *cache = NULL;
+
+    if (config->num_workers <= 0 || config->num_planners <= 0 || config->plan_depth <= 0 ||
+            config->max_active <= 0 || config->first_size < 0) {
+        fprintf(stderr, "invalid download engine config\n");
+        return NULL;
+    }
+
+    if (config->cache_dir && (cache = cache_open(config->cache_dir, config->cache_size)) == NULL) {
+        fprintf(stderr, "error opening cache: %s\n", config->cache_dir);
+        return NULL;
+    }
+
+    http_set_accept_encoding(config->decode);
+
+    DlEngine *engine = (DlEngine *)malloc(sizeof(DlEngine));
+    engine->config = *config;
+    engine->config.cache_dir = NULL;
+    engine->cache = cache;
+    engine->downloads = config->dedup ? url_table_alloc(free_first_download) : NULL;
+    engine->running = (const char **)calloc(config->max_active, sizeof(const char *));
+    pthread_mutex_init(&engine->lock, NULL);
+    pthread_cond_init(&engine->path_free, NULL);
+
+    engine->writer = NULL;
+    if (config->num_writers > 0) {
+        engine->writer = writer_alloc(config->num_writers, config->writer_budget,
+                config->writer_sync, &engine->config.threads);
+    }
+
+    engine->context = spawn_workers(config->num_workers, engine->writer, &engine->config.threads);
+
+    // planners and coordinators get the same stacks, but only the threads
+    // moving content are pinned
+    ThreadOptions unpinned = engine->config.threads;
+    unpinned.pin = 0;
+
+    // ranged requests never ask for compression, so when decoding the plan
+    // needs a HEAD request to find out whether the server compresses the content
+    engine->planner = planner_alloc(config->num_planners, config->plan_depth,
+            config->num_workers, config->decode ? 0 : config->first_size, cache, &unpinned);
+
+    engine->coordinators = (pthread_t *)malloc(sizeof(pthread_t) * config->max_active);
+    for (int i = 0; i < config->max_active; ++i) {
+        thread_create(&engine->coordinators[i], &unpinned, coordinator_thread, engine);
+    }
+
+    return engine;
+}
+
+
+/**
+ * Wait for all submitted downloads, stop the engine's threads and free it.
+ * No downloads may be submitted once this is called.
+ * @param engine - Pointer to the engine to free
+ */
+void dl_engine_free(DlEngine *engine) {
+    planner_finish(engine->planner);
+
+    for (int i = 0; i < engine->config.max_active; ++i) {
+        pthread_join(engine->coordinators[i], NULL);
+    }
+
+    planner_free(engine->planner);
+    free_workers(engine->context);
+
+    if (engine->writer) {
+        writer_free(engine->writer);
+    }
+
+    if (engine->cache) {
+        cache_close(engine->cache);
+    }
+
+    if (engine->downloads) {
+        url_table_free(engine->downloads);
+    }
+
+    pthread_mutex_destroy(&engine->lock);
+    pthread_cond_destroy(&engine->path_free);
+    free(engine->running);
+    free(engine->coordinators);
+    free(engine);
+}
+
+
+/**
+ * Submit a download. Blocks while the engine already has plan_depth
+ * downloads waiting to be planned.
+ * @param engine - Pointer to the engine
+ * @param url - The url to download, optionally followed by whitespace
+ *              separated mirrors of the same file
+ * @param path - The file to save it to, replaced if it exists. Chunks may
+ *               be kept next to it until they are merged.
+ * @param schedule - When the download is wanted, NULL for the default
+ *                   priority
+ * @param callback - Called once the download is done, or NULL
+ * @param arg - Passed to the callback
+ * @return download - The download, freed with dl_download_free
+ */
+DlDownload *dl_submit(DlEngine *engine, const char *url, const char *path,
+        const DlSchedule *schedule, DlCallback callback, void *arg) {
+    DlDownload *download = (DlDownload *)malloc(sizeof(DlDownload));
+    int priority = schedule ? schedule->priority : DL_PRIORITY_DEFAULT;
+
+    if (priority < DL_PRIORITY_MIN) {
+        priority = DL_PRIORITY_MIN;
+    }
+    else if (priority > DL_PRIORITY_MAX) {
+        priority = DL_PRIORITY_MAX;
+    }
+
+    download->strict = schedule && schedule->deadline_ms > 0;
+    download->deadline = now_ms() + (download->strict ? schedule->deadline_ms :
+            (DL_PRIORITY_MAX - priority + 1) * PRIORITY_SLACK_MS);
+
+    download->url = strdup(url);
+    download->path = strdup(path);
+    download->callback = callback;
+    download->arg = arg;
+    download->status = DL_PENDING;
+    download->holders = 2;
+    download->first = NULL;
+    download->waiting = NULL;
+    download->next = NULL;
+    memset(&download->result, 0, sizeof(DlResult));
+    download->result.status = DL_PENDING;
+    download->result.source = DL_SOURCE_NETWORK;
+    pthread_mutex_init(&download->lock, NULL);
+    pthread_cond_init(&download->finished, NULL);
+
+    // a url seen earlier (or an equivalent one) is only downloaded once, so
+    // a duplicate never costs a planning request
+    if (engine->downloads) {
+        char *first_url = strndup(url, strcspn(url, " \t"));
+        int duplicate = attach_duplicate(engine, download, first_url);
+
+        free(first_url);
+        if (duplicate) {
+            return download;
+        }
+    }
+
+    planner_submit(engine->planner, url, download->deadline, download);
+    return download;
+}
+
+
+/**
+ * Check whether a download is done without blocking
+ * @param download - Pointer to the download
+ * @return DL_PENDING while it is running, otherwise its status
+ */
+int dl_poll(DlDownload *download) {
+    pthread_mutex_lock(&download->lock);
+    int status = download->status;
+    pthread_mutex_unlock(&download->lock);
+
+    return status;
+}
+
+
+/**
+ * Wait for a download to be done
+ * @param download - Pointer to the download
+ * @return 0 if it was downloaded, -1 if it failed
+ */
+int dl_wait(DlDownload *download) {
+    pthread_mutex_lock(&download->lock);
+
+    while (download->status == DL_PENDING) {
+        pthread_cond_wait(&download->finished, &download->lock);
+    }
+
+    int status = download->status;
+    pthread_mutex_unlock(&download->lock);
+
+    return status;
+}
+
+
+/**
+ * Get what a download did once it is done
+ * @param download - Pointer to the download
+ * @param result - Filled with the result if the download is done. Its
+ *                 mirrors are owned by the download.
+ * @return DL_PENDING while it is running, otherwise its status
+ */
+int dl_result(DlDownload *download, DlResult *result) {
+    pthread_mutex_lock(&download->lock);
+    int status = download->status;
+
+    if (status != DL_PENDING) {
+        *result = download->result;
+    }
+
+    pthread_mutex_unlock(&download->lock);
+    return status;
+}
+
+
+/**
+ * Get the url a download was submitted with
+ * @param download - Pointer to the download
+ * @return The url, owned by the download
+ */
+const char *dl_url(DlDownload *download) {
+    return download->url;
+}
+
+
+/**
+ * Release the caller's hold on a download. A download that is still
+ * running carries on, and is freed by the engine once it is done.
+ * @param download - Pointer to the download
+ */
+void dl_download_free(DlDownload *download) {
+    release_download(download);
+}
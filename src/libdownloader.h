@@ -0,0 +1,199 @@
+#ifndef LIBDOWNLOADER_H
+#define LIBDOWNLOADER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "thread.h"
+
+
+/*
+ * DlEngine - a long lived download engine. Downloads may be submitted from
+ * any number of threads; they share the engine's planner threads, workers,
+ * writer stage and cache, so each batch pays for none of them again.
+ */
+typedef struct DlEngineStruct DlEngine;
+
+
+/*
+ * DlDownload - a submitted download. It is held both by the engine, until
+ * the download is done, and by the caller, until dl_download_free.
+ */
+typedef struct DlDownloadStruct DlDownload;
+
+
+// Returned by dl_poll while a download is still running
+#define DL_PENDING 1
+
+// Priorities of downloads, from background to most urgent
+#define DL_PRIORITY_MIN 0
+#define DL_PRIORITY_DEFAULT 5
+#define DL_PRIORITY_MAX 9
+
+
+/*
+ * DlSchedule - when a download is wanted. The engine plans and fetches
+ * the download due soonest first. A download without a deadline is due
+ * a while after it is submitted, sooner the higher its priority, so
+ * background downloads still make progress behind urgent ones.
+ */
+typedef struct {
+    int priority;           // DL_PRIORITY_MIN to DL_PRIORITY_MAX
+    int deadline_ms;        // Due this many ms after it is submitted, 0 to go by priority
+} DlSchedule;
+
+
+// Where the content of a download came from
+#define DL_SOURCE_NETWORK 0     // Fetched from its url and any mirrors
+#define DL_SOURCE_CACHE 1       // The cached copy was still valid
+#define DL_SOURCE_DUPLICATE 2   // Shared from the download of an equivalent url
+
+
+// What one origin of a mirrored download contributed
+typedef struct {
+    const char *url;
+    int chunks;
+    size_t bytes;
+    double rate;            // Bytes per second of one fetch
+    int dropped;            // Whether it was dropped for failing
+} DlMirrorResult;
+
+
+/*
+ * DlResult - what a download did. The engine prints nothing to stdout
+ * itself, so callers report downloads from this as they see fit.
+ */
+typedef struct {
+    int status;             // 0 if it was downloaded, -1 if it failed
+    int source;             // DL_SOURCE_NETWORK, DL_SOURCE_CACHE or DL_SOURCE_DUPLICATE
+    off_t bytes;            // Content bytes received
+    int chunks;             // Chunks received
+    int failed_chunks;      // Chunk fetches that failed, including ones fetched again
+    long late_ms;           // How long after its requested deadline it was done, 0 if in time
+
+    DlMirrorResult *mirrors;    // Each origin of a mirrored download, NULL if none
+    int num_mirrors;
+} DlResult;
+
+
+/**
+ * Called once a download is done, by an engine thread, or by dl_submit
+ * for a duplicate of a url the engine has already downloaded
+ * @param download - The download, valid for the duration of the call
+ * @param status - 0 if it was downloaded, -1 if it failed
+ * @param arg - The argument given to dl_submit
+ */
+typedef void (*DlCallback)(DlDownload *download, int status, void *arg);
+
+
+typedef struct {
+    int num_workers;        // Threads fetching chunks, and how many chunks a download is split into, more for huge files
+    int num_planners;       // Threads planning downloads ahead of the workers
+    int plan_depth;         // The most downloads planned ahead
+    int max_active;         // The most downloads being fetched at once
+    int first_size;         // Bytes requested speculatively to plan, 0 to plan with HEAD
+
+    int decode;             // Accept compressed content, decoded as it arrives
+    int use_mmap;           // Read content straight into a mapped output file
+    int dedup;              // Download a url (or an equivalent one) only once, keeping the
+                            // url and output path of each url until the engine is freed
+    int direct;             // Workers write chunks in place, and the last one finalizes the file
+
+    int num_writers;        // Threads of the writer stage, 0 for none
+    size_t writer_budget;   // Memory budget of the writer stage
+    size_t writer_sync;     // Writes this large have writeback started at once
+
+    const char *cache_dir;  // Where to keep a download cache, NULL for none
+    size_t cache_size;      // Size cap of the download cache
+
+    ThreadOptions threads;  // The stacks of all the engine's threads, and pinning of the worker and writer threads
+} DlConfig;
+
+
+/**
+ * Fill a config with the defaults
+ * @param config - The config to fill
+ */
+void dl_config_init(DlConfig *config);
+
+
+/**
+ * Create an engine and start its threads. Whether compressed content is
+ * accepted is set for the whole process.
+ * @param config - How to download, copied into the engine
+ * @return engine - Pointer to the engine or NULL on failure
+ */
+DlEngine *dl_engine_create(const DlConfig *config);
+
+
+/**
+ * Wait for all submitted downloads, stop the engine's threads and free it.
+ * No downloads may be submitted once this is called.
+ * @param engine - Pointer to the engine to free
+ */
+void dl_engine_free(DlEngine *engine);
+
+
+/**
+ * Submit a download. Blocks while the engine already has plan_depth
+ * downloads waiting to be planned. With dedup, a duplicate of a url
+ * already submitted is not planned or downloaded again, but given the
+ * output of the earlier download once it is done.
+ * @param engine - Pointer to the engine
+ * @param url - The url to download, optionally followed by whitespace
+ *              separated mirrors of the same file
+ * @param path - The file to save it to, replaced if it exists. Chunks may
+ *               be kept next to it until they are merged.
+ * @param schedule - When the download is wanted, NULL for the default
+ *                   priority
+ * @param callback - Called once the download is done, or NULL
+ * @param arg - Passed to the callback
+ * @return download - The download, freed with dl_download_free
+ */
+DlDownload *dl_submit(DlEngine *engine, const char *url, const char *path,
+        const DlSchedule *schedule, DlCallback callback, void *arg);
+
+
+/**
+ * Check whether a download is done without blocking
+ * @param download - Pointer to the download
+ * @return DL_PENDING while it is running, otherwise its status
+ */
+int dl_poll(DlDownload *download);
+
+
+/**
+ * Wait for a download to be done
+ * @param download - Pointer to the download
+ * @return 0 if it was downloaded, -1 if it failed
+ */
+int dl_wait(DlDownload *download);
+
+
+/**
+ * Get what a download did once it is done
+ * @param download - Pointer to the download
+ * @param result - Filled with the result if the download is done. Its
+ *                 mirrors are owned by the download.
+ * @return DL_PENDING while it is running, otherwise its status
+ */
+int dl_result(DlDownload *download, DlResult *result);
+
+
+/**
+ * Get the url a download was submitted with
+ * @param download - Pointer to the download
+ * @return The url, owned by the download
+ */
+const char *dl_url(DlDownload *download);
+
+
+/**
+ * Release the caller's hold on a download. A download that is still
+ * running carries on, and is freed by the engine once it is done.
+ * @param download - Pointer to the download
+ */
+void dl_download_free(DlDownload *download);
+
+
+#endif
@@ -0,0 +1,192 @@
+#include "mirror.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Consecutive failures after which an origin is dropped
+#define MIRROR_MAX_FAILURES 3
+
+// Weight of the newest sample in the throughput estimate
+#define MIRROR_RATE_WEIGHT 0.3
+
+
+typedef struct {
+    char *url;
+    double rate;        // Bytes per second of one fetch, 0 until measured
+    int in_flight;
+    int failures;       // Consecutive failures
+    int dropped;
+
+    int chunks;
+    size_t bytes;
+} Mirror;
+
+
+struct MirrorSetStruct {
+    Mirror *mirrors;
+    int count;
+
+    pthread_mutex_t lock;
+};
+
+
+/**
+ * Allocate a mirror set
+ * @param urls - The urls of the origins, copied into the set
+ * @param count - The number of urls
+ * @return set - Pointer to the mirror set
+ */
+MirrorSet *mirror_set_alloc(char **urls, int count) {
+    MirrorSet *set = (MirrorSet *)malloc(sizeof(MirrorSet));
+    set->mirrors = (Mirror *)calloc(count, sizeof(Mirror));
+    set->count = count;
+
+    for (int i = 0; i < count; ++i) {
+        set->mirrors[i].url = strdup(urls[i]);
+    }
+
+    pthread_mutex_init(&set->lock, NULL);
+    return set;
+}
+
+
+/**
+ * Free a mirror set
+ * @param set - Pointer to the mirror set to free
+ */
+void mirror_set_free(MirrorSet *set) {
+    for (int i = 0; i < set->count; ++i) {
+        free(set->mirrors[i].url);
+    }
+
+    pthread_mutex_destroy(&set->lock);
+    free(set->mirrors);
+    free(set);
+}
+
+
+/**
+ * Choose the origin to fetch the next chunk from, and count the chunk as in
+ * flight on it until mirror_done is called.
+ * @param set - Pointer to the mirror set
+ * @param avoid - An origin to only choose if no other is healthy, e.g. one
+ *                that just failed, or -1
+ * @return The index of the origin, or -1 if every origin has been dropped
+ */
+int mirror_pick(MirrorSet *set, int avoid) {
+    double best_rate = 0, best_time = 0;
+    int best = -1;
+
+    pthread_mutex_lock(&set->lock);
+
+    // origins not measured yet are assumed to be as fast as the fastest
+    for (int i = 0; i < set->count; ++i) {
+        if (set->mirrors[i].rate > best_rate) {
+            best_rate = set->mirrors[i].rate;
+        }
+    }
+
+    for (int pass = 0; pass < 2 && best == -1; ++pass) {
+        for (int i = 0; i < set->count; ++i) {
+            Mirror *mirror = &set->mirrors[i];
+
+            if (mirror->dropped || (pass == 0 && i == avoid)) {
+                continue;
+            }
+
+            // when the chunks in flight on it and this one would be done
+            double rate = mirror->rate > 0 ? mirror->rate : (best_rate > 0 ? best_rate : 1);
+            double time = (mirror->in_flight + 1) / rate;
+
+            if (best == -1 || time < best_time) {
+                best = i;
+                best_time = time;
+            }
+        }
+    }
+
+    if (best != -1) {
+        ++set->mirrors[best].in_flight;
+    }
+
+    pthread_mutex_unlock(&set->lock);
+    return best;
+}
+
+
+/**
+ * Get the url of an origin
+ * @param set - Pointer to the mirror set
+ * @param mirror - The index of the origin
+ * @return The url, owned by the set
+ */
+const char *mirror_url(MirrorSet *set, int mirror) {
+    return set->mirrors[mirror].url;
+}
+
+
+/**
+ * Record the outcome of a chunk fetched from an origin
+ * @param set - Pointer to the mirror set
+ * @param mirror - The index of the origin
+ * @param bytes - The number of bytes received, -1 if the fetch failed
+ * @param seconds - How long the fetch took
+ */
+void mirror_done(MirrorSet *set, int mirror, ssize_t bytes, double seconds) {
+    pthread_mutex_lock(&set->lock);
+    Mirror *m = &set->mirrors[mirror];
+
+    --m->in_flight;
+
+    if (bytes < 0) {
+        if (++m->failures >= MIRROR_MAX_FAILURES && !m->dropped) {
+            fprintf(stderr, "dropping mirror after %d failures: %s\n", m->failures, m->url);
+            m->dropped = 1;
+        }
+    }
+    else {
+        double rate = bytes / (seconds > 1e-6 ? seconds : 1e-6);
+
+        m->rate = m->rate > 0 ? m->rate + MIRROR_RATE_WEIGHT * (rate - m->rate) : rate;
+        m->failures = 0;
+        ++m->chunks;
+        m->bytes += bytes;
+    }
+
+    pthread_mutex_unlock(&set->lock);
+}
+
+
+/**
+ * Get the number of origins in a mirror set
+ * @param set - Pointer to the mirror set
+ * @return The number of origins, including any dropped
+ */
+int mirror_count(MirrorSet *set) {
+    return set->count;
+}
+
+
+/**
+ * Get how much an origin contributed
+ * @param set - Pointer to the mirror set
+ * @param mirror - The index of the origin
+ * @param chunks - Filled with the number of chunks fetched from it
+ * @param bytes - Filled with the number of bytes fetched from it
+ * @param rate - Filled with its throughput in bytes per second
+ * @return 1 if the origin was dropped, 0 otherwise
+ */
+int mirror_stats(MirrorSet *set, int mirror, int *chunks, size_t *bytes, double *rate) {
+    pthread_mutex_lock(&set->lock);
+    Mirror *m = &set->mirrors[mirror];
+
+    *chunks = m->chunks;
+    *bytes = m->bytes;
+    *rate = m->rate;
+    int dropped = m->dropped;
+
+    pthread_mutex_unlock(&set->lock);
+    return dropped;
+}
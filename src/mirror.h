@@ -0,0 +1,83 @@
+#ifndef MIRROR_H
+#define MIRROR_H
+
+#include <sys/types.h>
+
+
+/*
+ * MirrorSet - the origins one file can be downloaded from, with the
+ * throughput measured from each. Chunks are handed to the origin expected
+ * to finish them soonest, so each origin gets a share of the chunks in
+ * proportion to its throughput. An origin that keeps failing is dropped.
+ * A mirror set may be shared between threads.
+ */
+typedef struct MirrorSetStruct MirrorSet;
+
+
+/**
+ * Allocate a mirror set
+ * @param urls - The urls of the origins, copied into the set
+ * @param count - The number of urls
+ * @return set - Pointer to the mirror set
+ */
+MirrorSet *mirror_set_alloc(char **urls, int count);
+
+
+/**
+ * Free a mirror set
+ * @param set - Pointer to the mirror set to free
+ */
+void mirror_set_free(MirrorSet *set);
+
+
+/**
+ * Choose the origin to fetch the next chunk from, and count the chunk as in
+ * flight on it until mirror_done is called.
+ * @param set - Pointer to the mirror set
+ * @param avoid - An origin to only choose if no other is healthy, e.g. one
+ *                that just failed, or -1
+ * @return The index of the origin, or -1 if every origin has been dropped
+ */
+int mirror_pick(MirrorSet *set, int avoid);
+
+
+/**
+ * Get the url of an origin
+ * @param set - Pointer to the mirror set
+ * @param mirror - The index of the origin
+ * @return The url, owned by the set
+ */
+const char *mirror_url(MirrorSet *set, int mirror);
+
+
+/**
+ * Record the outcome of a chunk fetched from an origin
+ * @param set - Pointer to the mirror set
+ * @param mirror - The index of the origin
+ * @param bytes - The number of bytes received, -1 if the fetch failed
+ * @param seconds - How long the fetch took
+ */
+void mirror_done(MirrorSet *set, int mirror, ssize_t bytes, double seconds);
+
+
+/**
+ * Get the number of origins in a mirror set
+ * @param set - Pointer to the mirror set
+ * @return The number of origins, including any dropped
+ */
+int mirror_count(MirrorSet *set);
+
+
+/**
+ * Get how much an origin contributed
+ * @param set - Pointer to the mirror set
+ * @param mirror - The index of the origin
+ * @param chunks - Filled with the number of chunks fetched from it
+ * @param bytes - Filled with the number of bytes fetched from it
+ * @param rate - Filled with its throughput in bytes per second
+ * @return 1 if the origin was dropped, 0 otherwise
+ */
+int mirror_stats(MirrorSet *set, int mirror, int *chunks, size_t *bytes, double *rate);
+
+
+#endif
@@ -0,0 +1,268 @@
+#include "planner.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+// Urls with mirrors are split into this many chunks per thread, so that
+// faster mirrors can be given more of them
+#define MIRROR_SPLIT 4
+
+// The most mirrors listed for one url that are checked
+#define MAX_MIRRORS 16
+
+struct PlannerStruct {
+    PriorityQueue *urls;    // Plans to be made, from planner_submit
+    PriorityQueue *plans;   // From the planners to the caller
+
+    int threads;
+    int first_size;
+    Cache *cache;
+
+    pthread_t *planners;
+    int num_planners;
+
+    pthread_mutex_t lock;
+    int finished;       // Planners that have run out of urls
+};
+
+
+/**
+ * Check a mirror serves ranges of the same content as the url it mirrors.
+ * @return 1 if the mirror can be used, 0 otherwise
+ */
+static int check_mirror(const char *mirror, const Plan *plan) {
+    Validators validators;
+    off_t chunk_size = 0, length = 0;
+
+    // asking for two chunks tells us whether the mirror serves ranges
+    int num_tasks = http_plan((char *)mirror, 2, NULL, &validators, &chunk_size, &length);
+
+    if (length != plan->content_length || num_tasks < 2) {
+        fprintf(stderr, "mirror %s does not serve ranges of %lld bytes, ignoring it\n",
+                mirror, (long long)plan->content_length);
+        return 0;
+    }
+
+    if (validators.etag[0] != '\0' && plan->current.etag[0] != '\0' &&
+            strcmp(validators.etag, plan->current.etag) != 0) {
+        fprintf(stderr, "mirror %s has a different ETag, ignoring it\n", mirror);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/**
+ * Split a line into its url and mirrors, null terminating each in place.
+ * @return The number of mirrors found
+ */
+static int split_mirrors(char *line, char **mirrors) {
+    int count = 0;
+    char *p = line + strcspn(line, " \t");
+
+    while (*p != '\0') {
+        *p++ = '\0';
+        p += strspn(p, " \t");
+
+        if (*p != '\0' && count < MAX_MIRRORS) {
+            mirrors[count++] = p;
+        }
+
+        p += strcspn(p, " \t");
+    }
+
+    return count;
+}
+
+
+static void *planner_thread(void *arg) {
+    Planner *planner = (Planner *)arg;
+    char *mirrors[MAX_MIRRORS + 1];
+    Plan *plan = NULL;
+
+    trace_thread_name("planner");
+
+    while ((plan = (Plan *)pqueue_get(planner->urls)) != NULL) {
+        char *url = plan->url;
+        int num_mirrors = split_mirrors(url, mirrors + 1);
+        long start = trace_now();
+
+        trace_label("%s", url);
+        int threads = planner->threads * (num_mirrors > 0 ? MIRROR_SPLIT : 1);
+
+        plan->have_cached = planner->cache &&
+                cache_lookup(planner->cache, url, &plan->cached) == 0;
+
+        if (planner->first_size > 0) {
+            plan->num_tasks = http_plan_speculative(url, threads,
+                    planner->first_size, plan->have_cached ? &plan->cached : NULL,
+                    &plan->current, &plan->max_chunk_size, &plan->content_length,
+                    &plan->first);
+        }
+        else {
+            plan->first = NULL;
+            plan->num_tasks = http_plan(url, threads,
+                    plan->have_cached ? &plan->cached : NULL, &plan->current,
+                    &plan->max_chunk_size, &plan->content_length);
+        }
+
+        plan->first_length = plan->first ? plan->first->length : 0;
+
+        // mirrors only help when the download is split into ranges
+        if (num_mirrors > 0 && plan->num_tasks > 1) {
+            int usable = 1;
+            mirrors[0] = url;
+
+            for (int i = 1; i <= num_mirrors; ++i) {
+                if (check_mirror(mirrors[i], plan)) {
+                    mirrors[usable++] = mirrors[i];
+                }
+            }
+
+            if (usable > 1) {
+                plan->mirrors = mirror_set_alloc(mirrors, usable);
+            }
+        }
+
+        trace_span("plan", start);
+        pqueue_put(planner->plans, plan, plan->deadline);
+    }
+
+    pqueue_put(planner->plans, NULL, LONG_MAX);
+    return NULL;
+}
+
+
+/**
+ * Start the planner threads
+ * @param num_planners - The number of planner threads
+ * @param depth - The most urls waiting to be planned, and plans made ahead
+ *                of the caller
+ * @param threads - The number of threads each download is split between
+ * @param first_size - The number of bytes to request speculatively when
+ *                     planning, 0 to plan with a HEAD request
+ * @param cache - The download cache to revalidate against, or NULL
+ * @param options - How to place the planner threads, NULL for the defaults
+ * @return planner - Pointer to the planner
+ */
+Planner *planner_alloc(int num_planners, int depth, int threads, int first_size,
+        Cache *cache, ThreadOptions *options) {
+    Planner *planner = (Planner *)malloc(sizeof(Planner));
+    planner->urls = pqueue_alloc(depth);
+    planner->plans = pqueue_alloc(depth);
+    planner->threads = threads;
+    planner->first_size = first_size;
+    planner->cache = cache;
+    planner->num_planners = num_planners;
+    planner->finished = 0;
+    planner->planners = (pthread_t *)malloc(sizeof(pthread_t) * num_planners);
+    pthread_mutex_init(&planner->lock, NULL);
+
+    for (int i = 0; i < num_planners; ++i) {
+        thread_create(&planner->planners[i], options, planner_thread, planner);
+    }
+
+    return planner;
+}
+
+
+/**
+ * Submit a url to be planned. Blocks while depth urls are waiting.
+ * @param planner - Pointer to the planner
+ * @param url - The url, with any mirrors, copied into the plan
+ * @param deadline - When the download is wanted by, in ms on any clock
+ *                   shared by every url. Earlier urls are planned first.
+ * @param arg - Handed back in the plan
+ */
+void planner_submit(Planner *planner, const char *url, long deadline, void *arg) {
+    Plan *plan = (Plan *)malloc(sizeof(Plan));
+
+    plan->url = strdup(url);
+    plan->deadline = deadline;
+    plan->arg = arg;
+    plan->mirrors = NULL;
+    plan->first = NULL;
+
+    pqueue_put(planner->urls, plan, deadline);
+}
+
+
+/**
+ * Tell the planner no more urls will be submitted, so planner_next returns
+ * NULL once the last one has been planned
+ * @param planner - Pointer to the planner
+ */
+void planner_finish(Planner *planner) {
+    // after every real url, whatever its deadline
+    for (int i = 0; i < planner->num_planners; ++i) {
+        pqueue_put(planner->urls, NULL, LONG_MAX);
+    }
+}
+
+
+/**
+ * Get the plan with the earliest deadline of those made so far. May be
+ * called from several threads.
+ * @param planner - Pointer to the planner
+ * @return plan - The plan, freed with plan_free, or NULL after the last url
+ */
+Plan *planner_next(Planner *planner) {
+    Plan *plan = NULL;
+
+    while ((plan = (Plan *)pqueue_get(planner->plans)) == NULL) {
+        pthread_mutex_lock(&planner->lock);
+        int finished = ++planner->finished >= planner->num_planners;
+        pthread_mutex_unlock(&planner->lock);
+
+        // once every planner is done, pass the end on to the next caller
+        if (finished) {
+            pqueue_put(planner->plans, NULL, LONG_MAX);
+            return NULL;
+        }
+    }
+
+    return plan;
+}
+
+
+/**
+ * Free a plan
+ * @param plan - Pointer to the plan to free
+ */
+void plan_free(Plan *plan) {
+    if (plan->first) {
+        buffer_free(plan->first);
+    }
+
+    if (plan->mirrors) {
+        mirror_set_free(plan->mirrors);
+    }
+
+    free(plan->url);
+    free(plan);
+}
+
+
+/**
+ * Stop the planner threads and free the planner. Must be called only once
+ * planner_finish has been called and planner_next has returned NULL.
+ * @param planner - Pointer to the planner to free
+ */
+void planner_free(Planner *planner) {
+    for (int i = 0; i < planner->num_planners; ++i) {
+        pthread_join(planner->planners[i], NULL);
+    }
+
+    pthread_mutex_destroy(&planner->lock);
+
+    pqueue_free(planner->urls);
+    pqueue_free(planner->plans);
+
+    free(planner->planners);
+    free(planner);
+}
@@ -0,0 +1,106 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include "http.h"
+#include "cache.h"
+#include "mirror.h"
+#include "pqueue.h"
+#include "thread.h"
+
+
+/*
+ * Planner - plans each download ahead of time. Planner threads make each
+ * url's first request (a HEAD, or a speculative GET of the first range),
+ * so plans are ready before the fetchers need them. Urls go in and plans
+ * come out through bounded queues, so memory use does not grow with the
+ * number of urls submitted. Both queues hand out the url with the earliest
+ * deadline first.
+ *
+ * A url may be followed by mirrors of the same file, separated by
+ * whitespace. A mirror is only used if it serves ranges of content of the
+ * same size (and ETag, when both have one) as the url.
+ */
+typedef struct PlannerStruct Planner;
+
+
+// How to download a url
+typedef struct {
+    char *url;
+    int num_tasks;          // 0 if the cached copy is still valid
+    off_t max_chunk_size;
+    off_t content_length;   // -1 if unknown
+
+    Buffer *first;          // Content of the first task, already received
+    off_t first_length;     // Length of the first task's content, if any
+
+    MirrorSet *mirrors;     // The url and its usable mirrors, NULL if none
+
+    long deadline;          // When the download is wanted by, in ms
+    void *arg;              // The argument given to planner_submit
+
+    int have_cached;        // Whether cached holds the cached validators
+    Validators cached;
+    Validators current;     // The validators the server sent
+} Plan;
+
+
+/**
+ * Start the planner threads
+ * @param num_planners - The number of planner threads
+ * @param depth - The most urls waiting to be planned, and plans made ahead
+ *                of the caller
+ * @param threads - The number of threads each download is split between
+ * @param first_size - The number of bytes to request speculatively when
+ *                     planning, 0 to plan with a HEAD request
+ * @param cache - The download cache to revalidate against, or NULL
+ * @param options - How to place the planner threads, NULL for the defaults
+ * @return planner - Pointer to the planner
+ */
+Planner *planner_alloc(int num_planners, int depth, int threads, int first_size,
+        Cache *cache, ThreadOptions *options);
+
+
+/**
+ * Submit a url to be planned. Blocks while depth urls are waiting.
+ * @param planner - Pointer to the planner
+ * @param url - The url, with any mirrors, copied into the plan
+ * @param deadline - When the download is wanted by, in ms on any clock
+ *                   shared by every url. Earlier urls are planned first.
+ * @param arg - Handed back in the plan
+ */
+void planner_submit(Planner *planner, const char *url, long deadline, void *arg);
+
+
+/**
+ * Tell the planner no more urls will be submitted, so planner_next returns
+ * NULL once the last one has been planned
+ * @param planner - Pointer to the planner
+ */
+void planner_finish(Planner *planner);
+
+
+/**
+ * Get the plan with the earliest deadline of those made so far. May be
+ * called from several threads.
+ * @param planner - Pointer to the planner
+ * @return plan - The plan, freed with plan_free, or NULL after the last url
+ */
+Plan *planner_next(Planner *planner);
+
+
+/**
+ * Free a plan
+ * @param plan - Pointer to the plan to free
+ */
+void plan_free(Plan *plan);
+
+
+/**
+ * Stop the planner threads and free the planner. Must be called only once
+ * planner_finish has been called and planner_next has returned NULL.
+ * @param planner - Pointer to the planner to free
+ */
+void planner_free(Planner *planner);
+
+
+#endif
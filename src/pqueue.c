@@ -0,0 +1,163 @@
+#include "pqueue.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define PQUEUE_INITIAL_SIZE 64
+
+#define handle_error(msg) \
+        do { perror(msg); exit(EXIT_FAILURE); } while (0)
+
+
+typedef struct {
+    void *item;
+    long key;
+    unsigned long seq;      // Breaks ties between equal keys, oldest first
+} Entry;
+
+
+struct PriorityQueueStruct {
+    Entry *heap;            // A binary min heap
+    int count;
+    int capacity;           // Allocated entries
+    int limit;              // The most items held, 0 for no limit
+    unsigned long next_seq;
+
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+
+static int before(const Entry *a, const Entry *b) {
+    return a->key < b->key || (a->key == b->key && a->seq < b->seq);
+}
+
+
+static void swap(Entry *a, Entry *b) {
+    Entry t = *a;
+    *a = *b;
+    *b = t;
+}
+
+
+/**
+ * Allocate a concurrent priority queue
+ * @param size - The most items the queue holds, 0 for no limit
+ * @return queue - Pointer to the allocated queue
+ */
+PriorityQueue *pqueue_alloc(int size) {
+    PriorityQueue *queue = (PriorityQueue *)malloc(sizeof(PriorityQueue));
+    if (queue == NULL) {
+        handle_error("malloc");
+    }
+
+    queue->limit = size > 0 ? size : 0;
+    queue->capacity = size > 0 ? size : PQUEUE_INITIAL_SIZE;
+    queue->count = 0;
+    queue->next_seq = 0;
+
+    queue->heap = (Entry *)malloc(sizeof(Entry) * queue->capacity);
+    if (queue->heap == NULL) {
+        handle_error("malloc");
+    }
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+
+    return queue;
+}
+
+
+/**
+ * Free a concurrent priority queue. Don't call this function while the
+ * queue is still in use.
+ * @param queue - Pointer to the queue to free
+ */
+void pqueue_free(PriorityQueue *queue) {
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+
+    free(queue->heap);
+    free(queue);
+}
+
+
+/**
+ * Place an item into the queue, blocking while the queue is full
+ * @param queue - Pointer to the queue to add an item to
+ * @param item - An item to add to queue
+ * @param key - Items with lower keys are handed out first
+ */
+void pqueue_put(PriorityQueue *queue, void *item, long key) {
+    pthread_mutex_lock(&queue->lock);
+
+    while (queue->limit > 0 && queue->count == queue->limit) {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+
+    if (queue->count == queue->capacity) {
+        queue->capacity *= 2;
+        queue->heap = (Entry *)realloc(queue->heap, sizeof(Entry) * queue->capacity);
+        if (queue->heap == NULL) {
+            handle_error("realloc");
+        }
+    }
+
+    int i = queue->count++;
+    queue->heap[i].item = item;
+    queue->heap[i].key = key;
+    queue->heap[i].seq = queue->next_seq++;
+
+    // sift up
+    while (i > 0 && before(&queue->heap[i], &queue->heap[(i - 1) / 2])) {
+        swap(&queue->heap[i], &queue->heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+
+/**
+ * Get the item with the lowest key, blocking while the queue is empty
+ * @param queue - Pointer to queue to get item from
+ * @return item - item retrieved from queue
+ */
+void *pqueue_get(PriorityQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+
+    while (queue->count == 0) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+
+    void *item = queue->heap[0].item;
+    queue->heap[0] = queue->heap[--queue->count];
+
+    // sift down
+    for (int i = 0; ; ) {
+        int left = 2 * i + 1, right = left + 1, least = i;
+
+        if (left < queue->count && before(&queue->heap[left], &queue->heap[least])) {
+            least = left;
+        }
+        if (right < queue->count && before(&queue->heap[right], &queue->heap[least])) {
+            least = right;
+        }
+        if (least == i) {
+            break;
+        }
+
+        swap(&queue->heap[i], &queue->heap[least]);
+        i = least;
+    }
+
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return item;
+}
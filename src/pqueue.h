@@ -0,0 +1,46 @@
+#ifndef PQUEUE_H
+#define PQUEUE_H
+
+
+/*
+ * PriorityQueue - a concurrent queue handing out the item with the lowest
+ * key first, e.g. the earliest deadline. Items with equal keys come out in
+ * the order they were put in.
+ */
+typedef struct PriorityQueueStruct PriorityQueue;
+
+
+/**
+ * Allocate a concurrent priority queue
+ * @param size - The most items the queue holds, 0 for no limit
+ * @return queue - Pointer to the allocated queue
+ */
+PriorityQueue *pqueue_alloc(int size);
+
+
+/**
+ * Free a concurrent priority queue. Don't call this function while the
+ * queue is still in use.
+ * @param queue - Pointer to the queue to free
+ */
+void pqueue_free(PriorityQueue *queue);
+
+
+/**
+ * Place an item into the queue, blocking while the queue is full
+ * @param queue - Pointer to the queue to add an item to
+ * @param item - An item to add to queue
+ * @param key - Items with lower keys are handed out first
+ */
+void pqueue_put(PriorityQueue *queue, void *item, long key);
+
+
+/**
+ * Get the item with the lowest key, blocking while the queue is empty
+ * @param queue - Pointer to queue to get item from
+ * @return item - item retrieved from queue
+ */
+void *pqueue_get(PriorityQueue *queue);
+
+
+#endif
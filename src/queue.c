@@ -20,6 +20,14 @@
  * but it is hidden from the outside.
  */
 typedef struct QueueStruct {
+    void **items;
+    int size;
+    int head;
+    int tail;
+
+    pthread_mutex_t lock;
+    sem_t free_slots;
+    sem_t used_slots;
 } Queue;
 
 
@@ -29,7 +37,36 @@ typedef struct QueueStruct {
  * @return queue - Pointer to the allocated queue
  */
 Queue *queue_alloc(int size) {
-    assert(0 && "not implemented yet!");
+    assert(size > 0);
+
+    Queue *queue = (Queue*)malloc(sizeof(Queue));
+    if (queue == NULL) {
+        handle_error("malloc");
+    }
+
+    queue->items = (void**)malloc(sizeof(void*) * size);
+    if (queue->items == NULL) {
+        handle_error("malloc");
+    }
+
+    queue->size = size;
+    queue->head = 0;
+    queue->tail = 0;
+
+    int rc = pthread_mutex_init(&queue->lock, NULL);
+    if (rc != 0) {
+        handle_error_en(rc, "pthread_mutex_init");
+    }
+
+    if (sem_init(&queue->free_slots, 0, size) == -1) {
+        handle_error("sem_init");
+    }
+
+    if (sem_init(&queue->used_slots, 0, 0) == -1) {
+        handle_error("sem_init");
+    }
+
+    return queue;
 }
 
 
@@ -43,7 +80,12 @@ Queue *queue_alloc(int size) {
  * @param queue - Pointer to the queue to free
  */
 void queue_free(Queue *queue) {
-    assert(0 && "not implemented yet!");
+    pthread_mutex_destroy(&queue->lock);
+    sem_destroy(&queue->free_slots);
+    sem_destroy(&queue->used_slots);
+
+    free(queue->items);
+    free(queue);
 }
 
 
@@ -59,7 +101,18 @@ void queue_free(Queue *queue) {
  *               it is correctly typed.
  */
 void queue_put(Queue *queue, void *item) {
-    assert(0 && "not implemented yet!");
+    while (sem_wait(&queue->free_slots) == -1) {
+        if (errno != EINTR) {
+            handle_error("sem_wait");
+        }
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    queue->items[queue->tail] = item;
+    queue->tail = (queue->tail + 1) % queue->size;
+    pthread_mutex_unlock(&queue->lock);
+
+    sem_post(&queue->used_slots);
 }
 
 
@@ -75,6 +128,18 @@ void queue_put(Queue *queue, void *item) {
  *                arbitrary 
  */
 void *queue_get(Queue *queue) {
-    assert(0 && "not implemented yet!");
+    while (sem_wait(&queue->used_slots) == -1) {
+        if (errno != EINTR) {
+            handle_error("sem_wait");
+        }
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    void *item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->size;
+    pthread_mutex_unlock(&queue->lock);
+
+    sem_post(&queue->free_slots);
+    return item;
 }
 
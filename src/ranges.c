@@ -0,0 +1,152 @@
+#include "ranges.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RANGES_INITIAL_SIZE 4
+
+
+typedef struct {
+    off_t start;
+    off_t end;          // One past the last byte
+} Range;
+
+
+struct RangeSetStruct {
+    Range *ranges;      // Sorted by start, disjoint and not touching
+    int count;
+    int capacity;
+
+    pthread_mutex_t lock;
+};
+
+
+/**
+ * Allocate a range set
+ * @param start - The first byte of the range the set starts with
+ * @param end - One past the last byte, the set starts empty if not after start
+ * @return set - Pointer to the range set
+ */
+RangeSet *range_set_alloc(off_t start, off_t end) {
+    RangeSet *set = (RangeSet *)malloc(sizeof(RangeSet));
+    set->ranges = (Range *)malloc(sizeof(Range) * RANGES_INITIAL_SIZE);
+    set->count = 0;
+    set->capacity = RANGES_INITIAL_SIZE;
+
+    if (end > start) {
+        set->ranges[0].start = start;
+        set->ranges[0].end = end;
+        set->count = 1;
+    }
+
+    pthread_mutex_init(&set->lock, NULL);
+    return set;
+}
+
+
+/**
+ * Free a range set
+ * @param set - Pointer to the range set to free
+ */
+void range_set_free(RangeSet *set) {
+    pthread_mutex_destroy(&set->lock);
+    free(set->ranges);
+    free(set);
+}
+
+
+/**
+ * Add a range to the set, merging it with any ranges it touches
+ * @param set - Pointer to the range set
+ * @param start - The first byte of the range
+ * @param end - One past the last byte of the range
+ */
+void range_set_add(RangeSet *set, off_t start, off_t end) {
+    if (end <= start) {
+        return;
+    }
+
+    pthread_mutex_lock(&set->lock);
+
+    // the ranges from first up to last touch the new one
+    int first = 0;
+    while (first < set->count && set->ranges[first].end < start) {
+        ++first;
+    }
+
+    int last = first;
+    while (last < set->count && set->ranges[last].start <= end) {
+        if (set->ranges[last].start < start) {
+            start = set->ranges[last].start;
+        }
+        if (set->ranges[last].end > end) {
+            end = set->ranges[last].end;
+        }
+        ++last;
+    }
+
+    if (last == first && set->count == set->capacity) {
+        set->capacity *= 2;
+        set->ranges = (Range *)realloc(set->ranges, sizeof(Range) * set->capacity);
+    }
+
+    // replace the touching ranges with the merged one
+    memmove(&set->ranges[first + 1], &set->ranges[last], sizeof(Range) * (set->count - last));
+    set->count += 1 - (last - first);
+    set->ranges[first].start = start;
+    set->ranges[first].end = end;
+
+    pthread_mutex_unlock(&set->lock);
+}
+
+
+/**
+ * Take the lowest bytes of the set, at most max_length of them
+ * @param set - Pointer to the range set
+ * @param max_length - The most bytes to take
+ * @param start - Filled with the first byte taken
+ * @param end - Filled with one past the last byte taken
+ * @return 0 on success, -1 if the set is empty
+ */
+int range_set_carve(RangeSet *set, off_t max_length, off_t *start, off_t *end) {
+    int rc = -1;
+
+    pthread_mutex_lock(&set->lock);
+
+    if (set->count > 0) {
+        Range *range = &set->ranges[0];
+
+        *start = range->start;
+        *end = range->end - range->start > max_length ? range->start + max_length : range->end;
+        range->start = *end;
+
+        if (range->start == range->end) {
+            memmove(&set->ranges[0], &set->ranges[1], sizeof(Range) * --set->count);
+        }
+
+        rc = 0;
+    }
+
+    pthread_mutex_unlock(&set->lock);
+    return rc;
+}
+
+
+/**
+ * Get the number of bytes in the set
+ * @param set - Pointer to the range set
+ * @return The number of bytes
+ */
+off_t range_set_bytes(RangeSet *set) {
+    off_t bytes = 0;
+
+    pthread_mutex_lock(&set->lock);
+
+    for (int i = 0; i < set->count; ++i) {
+        bytes += set->ranges[i].end - set->ranges[i].start;
+    }
+
+    pthread_mutex_unlock(&set->lock);
+    return bytes;
+}
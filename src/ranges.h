@@ -0,0 +1,61 @@
+#ifndef RANGES_H
+#define RANGES_H
+
+#include <sys/types.h>
+
+
+/*
+ * RangeSet - the byte ranges of a download still to be fetched, kept as a
+ * sorted list of disjoint intervals. Chunks are carved off the front as
+ * they are handed out and put back if they fail, so an object of any size
+ * is described by a handful of intervals rather than one entry per chunk.
+ * A range set may be shared between threads.
+ */
+typedef struct RangeSetStruct RangeSet;
+
+
+/**
+ * Allocate a range set
+ * @param start - The first byte of the range the set starts with
+ * @param end - One past the last byte, the set starts empty if not after start
+ * @return set - Pointer to the range set
+ */
+RangeSet *range_set_alloc(off_t start, off_t end);
+
+
+/**
+ * Free a range set
+ * @param set - Pointer to the range set to free
+ */
+void range_set_free(RangeSet *set);
+
+
+/**
+ * Add a range to the set, merging it with any ranges it touches
+ * @param set - Pointer to the range set
+ * @param start - The first byte of the range
+ * @param end - One past the last byte of the range
+ */
+void range_set_add(RangeSet *set, off_t start, off_t end);
+
+
+/**
+ * Take the lowest bytes of the set, at most max_length of them
+ * @param set - Pointer to the range set
+ * @param max_length - The most bytes to take
+ * @param start - Filled with the first byte taken
+ * @param end - Filled with one past the last byte taken
+ * @return 0 on success, -1 if the set is empty
+ */
+int range_set_carve(RangeSet *set, off_t max_length, off_t *start, off_t *end);
+
+
+/**
+ * Get the number of bytes in the set
+ * @param set - Pointer to the range set
+ * @return The number of bytes
+ */
+off_t range_set_bytes(RangeSet *set);
+
+
+#endif
@@ -0,0 +1,78 @@
+#define _GNU_SOURCE
+#include "thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+
+#define handle_error_en(en, msg) \
+        do { errno = en; perror(msg); exit(EXIT_FAILURE); } while (0)
+
+
+/**
+ * Find the n-th cpu (wrapping around) the process may run on.
+ * @return The cpu, or -1 if the allowed cpus are unknown
+ */
+static int allowed_cpu(int n, cpu_set_t *set) {
+    if (sched_getaffinity(0, sizeof(cpu_set_t), set) == -1 || CPU_COUNT(set) == 0) {
+        return -1;
+    }
+
+    n %= CPU_COUNT(set);
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, set) && n-- == 0) {
+            return cpu;
+        }
+    }
+
+    return -1;
+}
+
+
+/**
+ * Create a thread placed as the options ask, exiting on failure. Only one
+ * thread may create threads with the same options at a time.
+ * @param thread - Filled with the id of the thread
+ * @param options - How to place the thread, NULL for the defaults
+ * @param start - The function the thread runs
+ * @param arg - Passed to start
+ */
+void thread_create(pthread_t *thread, ThreadOptions *options, void *(*start)(void *), void *arg) {
+    pthread_attr_t attr;
+    cpu_set_t set;
+    int rc = 0, cpu = -1;
+
+    pthread_attr_init(&attr);
+
+    if (options && options->stack_size > 0) {
+        size_t size = options->stack_size < THREAD_MIN_STACK ? THREAD_MIN_STACK : options->stack_size;
+
+        if (size < PTHREAD_STACK_MIN) {
+            size = PTHREAD_STACK_MIN;
+        }
+
+        if ((rc = pthread_attr_setstacksize(&attr, size)) != 0) {
+            handle_error_en(rc, "pthread_attr_setstacksize");
+        }
+    }
+
+    // set before the thread starts, so its stack and first allocations are
+    // already on the right node
+    if (options && options->pin && (cpu = allowed_cpu(options->next_cpu++, &set)) != -1) {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+
+        if ((rc = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &set)) != 0) {
+            handle_error_en(rc, "pthread_attr_setaffinity_np");
+        }
+    }
+
+    if ((rc = pthread_create(thread, &attr, start, arg)) != 0) {
+        handle_error_en(rc, "pthread_create");
+    }
+
+    pthread_attr_destroy(&attr);
+}
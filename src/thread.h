@@ -0,0 +1,37 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+// The smallest stack a thread is given. Threads resolve hosts with
+// getaddrinfo and keep path, host and trace buffers on their stacks, which
+// overflows anything much smaller.
+#define THREAD_MIN_STACK (64 * 1024)
+
+
+/*
+ * ThreadOptions - how to place the threads of a pool. Pinned threads take
+ * the cpus the process may run on in turn, so a cpu set given with taskset
+ * (e.g. the cpus near the network card) is respected. Memory a pinned
+ * thread touches first is allocated on its own NUMA node.
+ */
+typedef struct {
+    size_t stack_size;      // Bytes of stack for each thread, raised to THREAD_MIN_STACK, 0 for the default
+    int pin;                // Pin each thread to a single cpu
+    int next_cpu;           // Which allowed cpu the next pinned thread takes
+} ThreadOptions;
+
+
+/**
+ * Create a thread placed as the options ask, exiting on failure. Only one
+ * thread may create threads with the same options at a time.
+ * @param thread - Filled with the id of the thread
+ * @param options - How to place the thread, NULL for the defaults
+ * @param start - The function the thread runs
+ * @param arg - Passed to start
+ */
+void thread_create(pthread_t *thread, ThreadOptions *options, void *(*start)(void *), void *arg);
+
+
+#endif
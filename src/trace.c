@@ -0,0 +1,197 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#define TRACE_LABEL_SIZE 112
+#define TRACE_NAME_SIZE 32
+
+
+typedef struct {
+    const char *name;
+    long start;
+    long end;
+    char label[TRACE_LABEL_SIZE];
+} TraceEvent;
+
+
+// The spans of one thread, only ever written by that thread
+typedef struct TraceRingStruct {
+    TraceEvent events[TRACE_RING_SIZE];
+    unsigned long count;            // Spans ever recorded
+    int tid;
+
+    char name[TRACE_NAME_SIZE];
+    char label[TRACE_LABEL_SIZE];   // Label of the spans recorded next
+
+    struct TraceRingStruct *next;
+} TraceRing;
+
+
+#ifndef NO_TRACE
+int trace_enabled = 0;
+#endif
+
+static long trace_start;
+
+static __thread TraceRing *thread_ring = NULL;
+
+// Every thread's ring, pushed without a lock
+static TraceRing *rings = NULL;
+static int next_tid = 0;
+
+
+/**
+ * Start tracing. Call this before starting the threads to trace.
+ * @return 0 on success, -1 if tracing was compiled out
+ */
+int trace_enable(void) {
+#ifdef NO_TRACE
+    return -1;
+#else
+    trace_start = trace_clock();
+    trace_enabled = 1;
+    return 0;
+#endif
+}
+
+
+// The monotonic clock in ns, which spans are timed with
+long trace_clock(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+
+/**
+ * Get the calling thread's ring, creating it on the first span
+ */
+static TraceRing *get_ring(void) {
+    TraceRing *ring = thread_ring;
+
+    if (ring == NULL) {
+        ring = (TraceRing *)calloc(1, sizeof(TraceRing));
+        ring->tid = __atomic_add_fetch(&next_tid, 1, __ATOMIC_RELAXED);
+        snprintf(ring->name, TRACE_NAME_SIZE, "thread %d", ring->tid);
+
+        ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 1,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+
+        thread_ring = ring;
+    }
+
+    return ring;
+}
+
+
+void trace_record(const char *name, long start, long end) {
+    TraceRing *ring = get_ring();
+    TraceEvent *event = &ring->events[ring->count++ % TRACE_RING_SIZE];
+
+    event->name = name;
+    event->start = start;
+    event->end = end;
+    memcpy(event->label, ring->label, TRACE_LABEL_SIZE);
+}
+
+
+void trace_set_label(const char *format, ...) {
+    TraceRing *ring = get_ring();
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(ring->label, TRACE_LABEL_SIZE, format, args);
+    va_end(args);
+}
+
+
+void trace_set_thread_name(const char *name) {
+    TraceRing *ring = get_ring();
+
+    snprintf(ring->name, TRACE_NAME_SIZE, "%s %d", name, ring->tid);
+}
+
+
+/**
+ * Write a string as the contents of a JSON string
+ */
+static void write_escaped(FILE *out, const char *s) {
+    for (; *s != '\0'; ++s) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(out, "\\%c", *s);
+        }
+        else if ((unsigned char)*s < 0x20) {
+            fprintf(out, "\\u%04x", *s);
+        }
+        else {
+            fputc(*s, out);
+        }
+    }
+}
+
+
+/**
+ * Write every recorded span to a file as Chrome trace event JSON and stop
+ * tracing. Every other thread that recorded spans must have exited.
+ * @param path - The file to write
+ * @return 0 on success, -1 if the file could not be written
+ */
+int trace_dump(const char *path) {
+    TraceRing *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE), *next = NULL;
+    FILE *out = fopen(path, "w");
+    int first = 1, rc = 0;
+
+    if (out == NULL) {
+        perror(path);
+        rc = -1;
+    }
+    else {
+        fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    }
+
+    for (; ring != NULL; ring = next) {
+        unsigned long i = ring->count > TRACE_RING_SIZE ? ring->count - TRACE_RING_SIZE : 0;
+
+        if (out != NULL) {
+            fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                    "\"args\":{\"name\":\"%s\"}}", first ? "" : ",", ring->tid, ring->name);
+            first = 0;
+
+            for (; i < ring->count; ++i) {
+                TraceEvent *event = &ring->events[i % TRACE_RING_SIZE];
+
+                // timestamps are in microseconds
+                fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                        "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"label\":\"", event->name, ring->tid,
+                        (event->start - trace_start) / 1e3, (event->end - event->start) / 1e3);
+                write_escaped(out, event->label);
+                fprintf(out, "\"}}");
+            }
+        }
+
+        next = ring->next;
+        free(ring);
+    }
+
+    if (out != NULL) {
+        fprintf(out, "\n]}\n");
+        if (fclose(out) != 0) {
+            perror(path);
+            rc = -1;
+        }
+    }
+
+#ifndef NO_TRACE
+    trace_enabled = 0;
+#endif
+    rings = NULL;
+    thread_ring = NULL;
+    return rc;
+}
@@ -0,0 +1,85 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+
+/*
+ * Tracing - spans of time recorded per thread, e.g. how long a request
+ * spent connecting or a chunk spent queued, dumped as Chrome trace event
+ * JSON (for chrome://tracing or Perfetto). Each thread records into its
+ * own ring buffer without locking, keeping its most recent
+ * TRACE_RING_SIZE spans. While tracing is off every call is a single
+ * branch, and building with -DNO_TRACE removes them altogether.
+ */
+
+// Spans each thread keeps, the oldest are overwritten
+#define TRACE_RING_SIZE 4096
+
+#ifdef NO_TRACE
+#define trace_enabled 0
+#else
+extern int trace_enabled;
+#endif
+
+
+/**
+ * Start tracing. Call this before starting the threads to trace.
+ * @return 0 on success, -1 if tracing was compiled out
+ */
+int trace_enable(void);
+
+
+/**
+ * Write every recorded span to a file as Chrome trace event JSON and stop
+ * tracing. Every other thread that recorded spans must have exited.
+ * @param path - The file to write
+ * @return 0 on success, -1 if the file could not be written
+ */
+int trace_dump(const char *path);
+
+
+// The monotonic clock in ns, which spans are timed with
+long trace_clock(void);
+
+void trace_record(const char *name, long start, long end);
+
+void trace_set_label(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+void trace_set_thread_name(const char *name);
+
+
+/**
+ * Get the time a span starts at
+ * @return The time in ns, 0 while tracing is off
+ */
+inline static long trace_now(void) {
+    return trace_enabled ? trace_clock() : 0;
+}
+
+
+/**
+ * Record a span on the calling thread, ending now
+ * @param name - What the span is, e.g. "connect". Must be a string literal.
+ * @param start - When the span started, from trace_now
+ */
+#define trace_span(name, start) \
+        do { if (trace_enabled) trace_record(name, start, trace_clock()); } while (0)
+
+
+/**
+ * Label the spans the calling thread records from now on, e.g. with the
+ * url it is fetching
+ * @param ... - A printf format and its arguments
+ */
+#define trace_label(...) \
+        do { if (trace_enabled) trace_set_label(__VA_ARGS__); } while (0)
+
+
+/**
+ * Name the calling thread in the trace
+ * @param name - The name, e.g. "worker"
+ */
+#define trace_thread_name(name) \
+        do { if (trace_enabled) trace_set_thread_name(name); } while (0)
+
+
+#endif
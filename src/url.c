@@ -0,0 +1,221 @@
+#include "url.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#define URL_TABLE_INITIAL_SIZE 64
+#define URL_SIZE 1024
+
+#define handle_error(msg) \
+        do { perror(msg); exit(EXIT_FAILURE); } while (0)
+
+
+typedef struct UrlEntryStruct {
+    char *url;      // Normalized
+    void *value;
+    uint32_t hash;
+
+    struct UrlEntryStruct *next;
+} UrlEntry;
+
+
+struct UrlTableStruct {
+    UrlEntry **buckets;
+    int num_buckets;
+    int count;
+
+    UrlFree free_value;
+};
+
+
+/**
+ * Normalize a url so equivalent urls compare equal. Any http:// scheme and
+ * default port are dropped, the host is lower cased and a trailing slash is
+ * removed from the path. The path is otherwise left alone as it is case
+ * sensitive.
+ * @param url - The url e.g. WWW.Canterbury.ac.nz:80/index.html/
+ * @param normalized - Filled with the normalized url
+ *                     e.g. www.canterbury.ac.nz/index.html
+ * @param size - The size of normalized
+ */
+void url_normalize(const char *url, char *normalized, size_t size) {
+    size_t n = 0;
+
+    if (strncasecmp(url, "http://", 7) == 0) {
+        url += 7;
+    }
+
+    while (*url && *url != '/' && *url != ':' && n < size - 1) {
+        normalized[n++] = tolower((unsigned char)*url++);
+    }
+
+    if (strncmp(url, ":80", 3) == 0 && (url[3] == '/' || url[3] == '\0')) {
+        url += 3;
+    }
+
+    while (*url && n < size - 1) {
+        normalized[n++] = *url++;
+    }
+
+    if (n > 0 && normalized[n - 1] == '/') {
+        --n;
+    }
+
+    normalized[n] = '\0';
+}
+
+
+/**
+ * Hash a string (FNV-1a)
+ * @param url - The string to hash
+ * @return The hash
+ */
+uint32_t url_hash(const char *url) {
+    uint32_t hash = 2166136261u;
+
+    while (*url) {
+        hash = (hash ^ (unsigned char)*url++) * 16777619u;
+    }
+
+    return hash;
+}
+
+
+static void url_table_resize(UrlTable *table, int num_buckets) {
+    UrlEntry **buckets = (UrlEntry **)calloc(num_buckets, sizeof(UrlEntry *));
+    if (buckets == NULL) {
+        handle_error("calloc");
+    }
+
+    for (int i = 0; i < table->num_buckets; ++i) {
+        UrlEntry *entry = table->buckets[i];
+
+        while (entry) {
+            UrlEntry *next = entry->next;
+            entry->next = buckets[entry->hash % num_buckets];
+            buckets[entry->hash % num_buckets] = entry;
+            entry = next;
+        }
+    }
+
+    free(table->buckets);
+    table->buckets = buckets;
+    table->num_buckets = num_buckets;
+}
+
+
+/**
+ * Allocate an empty url table
+ * @param free_value - Frees a value once it is replaced or the table is
+ *                     freed, or NULL if the table does not own its values
+ * @return table - Pointer to the table
+ */
+UrlTable *url_table_alloc(UrlFree free_value) {
+    UrlTable *table = (UrlTable *)malloc(sizeof(UrlTable));
+    if (table == NULL) {
+        handle_error("malloc");
+    }
+
+    table->buckets = NULL;
+    table->num_buckets = 0;
+    table->count = 0;
+    table->free_value = free_value;
+    url_table_resize(table, URL_TABLE_INITIAL_SIZE);
+
+    return table;
+}
+
+
+/**
+ * Free a url table and the entries it holds
+ * @param table - Pointer to the table to free
+ */
+void url_table_free(UrlTable *table) {
+    for (int i = 0; i < table->num_buckets; ++i) {
+        UrlEntry *entry = table->buckets[i];
+
+        while (entry) {
+            UrlEntry *next = entry->next;
+            if (table->free_value) {
+                table->free_value(entry->value);
+            }
+
+            free(entry->url);
+            free(entry);
+            entry = next;
+        }
+    }
+
+    free(table->buckets);
+    free(table);
+}
+
+
+static UrlEntry *url_table_find(UrlTable *table, const char *normalized, uint32_t hash) {
+    UrlEntry *entry = table->buckets[hash % table->num_buckets];
+
+    while (entry && (entry->hash != hash || strcmp(entry->url, normalized) != 0)) {
+        entry = entry->next;
+    }
+
+    return entry;
+}
+
+
+/**
+ * Look up the value of a url (or an equivalent url)
+ * @param table - Pointer to the table
+ * @param url - The url to look up
+ * @return The value, or NULL if the url is not present
+ */
+void *url_table_get(UrlTable *table, const char *url) {
+    char normalized[URL_SIZE];
+
+    url_normalize(url, normalized, URL_SIZE);
+    UrlEntry *entry = url_table_find(table, normalized, url_hash(normalized));
+
+    return entry ? entry->value : NULL;
+}
+
+
+/**
+ * Set the value of a url, replacing any previous value
+ * @param table - Pointer to the table
+ * @param url - The url
+ * @param value - The value, owned by the table if it has a free_value
+ */
+void url_table_put(UrlTable *table, const char *url, void *value) {
+    char normalized[URL_SIZE];
+
+    url_normalize(url, normalized, URL_SIZE);
+    uint32_t hash = url_hash(normalized);
+    UrlEntry *entry = url_table_find(table, normalized, hash);
+
+    if (entry) {
+        if (table->free_value && entry->value != value) {
+            table->free_value(entry->value);
+        }
+
+        entry->value = value;
+        return;
+    }
+
+    if (table->count + 1 > table->num_buckets * 3 / 4) {
+        url_table_resize(table, table->num_buckets * 2);
+    }
+
+    entry = (UrlEntry *)malloc(sizeof(UrlEntry));
+    if (entry == NULL) {
+        handle_error("malloc");
+    }
+
+    entry->url = strdup(normalized);
+    entry->value = value;
+    entry->hash = hash;
+    entry->next = table->buckets[hash % table->num_buckets];
+    table->buckets[hash % table->num_buckets] = entry;
+    ++table->count;
+}
@@ -0,0 +1,75 @@
+#ifndef URL_H
+#define URL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * UrlTable - a hash table from urls to values, e.g. the download of each
+ * url. Urls are normalized before they are hashed, so equivalent urls
+ * share an entry.
+ */
+typedef struct UrlTableStruct UrlTable;
+
+
+// Frees a value of a url table
+typedef void (*UrlFree)(void *value);
+
+
+/**
+ * Normalize a url so equivalent urls compare equal. Any http:// scheme and
+ * default port are dropped, the host is lower cased and a trailing slash is
+ * removed from the path. The path is otherwise left alone as it is case
+ * sensitive.
+ * @param url - The url e.g. WWW.Canterbury.ac.nz:80/index.html/
+ * @param normalized - Filled with the normalized url
+ *                     e.g. www.canterbury.ac.nz/index.html
+ * @param size - The size of normalized
+ */
+void url_normalize(const char *url, char *normalized, size_t size);
+
+
+/**
+ * Hash a string (FNV-1a)
+ * @param url - The string to hash
+ * @return The hash
+ */
+uint32_t url_hash(const char *url);
+
+
+/**
+ * Allocate an empty url table
+ * @param free_value - Frees a value once it is replaced or the table is
+ *                     freed, or NULL if the table does not own its values
+ * @return table - Pointer to the table
+ */
+UrlTable *url_table_alloc(UrlFree free_value);
+
+
+/**
+ * Free a url table and the entries it holds
+ * @param table - Pointer to the table to free
+ */
+void url_table_free(UrlTable *table);
+
+
+/**
+ * Look up the value of a url (or an equivalent url)
+ * @param table - Pointer to the table
+ * @param url - The url to look up
+ * @return The value, or NULL if the url is not present
+ */
+void *url_table_get(UrlTable *table, const char *url);
+
+
+/**
+ * Set the value of a url, replacing any previous value
+ * @param table - Pointer to the table
+ * @param url - The url
+ * @param value - The value, owned by the table if it has a free_value
+ */
+void url_table_put(UrlTable *table, const char *url, void *value);
+
+
+#endif
@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+
+#include "writer.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <assert.h>
+
+// The most chunks coalesced into a single write
+#define MAX_COALESCE 64
+
+#define handle_error_en(en, msg) \
+        do { errno = en; perror(msg); exit(EXIT_FAILURE); } while (0)
+
+#define handle_error(msg) \
+        do { perror(msg); exit(EXIT_FAILURE); } while (0)
+
+
+typedef struct WriteStruct {
+    int fd;
+    off_t offset;
+    const char *data;
+    size_t length;
+
+    WriteCallback callback;
+    void *arg;
+
+    struct WriteStruct *next;
+} Write;
+
+
+struct WriterStruct {
+    Write *pending;         // Sorted by fd, then offset
+    size_t pending_bytes;   // Bytes pending or being written
+    size_t budget;
+    size_t sync_bytes;
+    int stopping;
+
+    pthread_mutex_t lock;
+    pthread_cond_t has_work;
+    pthread_cond_t has_space;
+
+    pthread_t *threads;
+    int num_threads;
+};
+
+
+/**
+ * Write a run of adjacent chunks with as few system calls as possible.
+ * @return 0 on success, -1 on failure
+ */
+static int write_run(Write *first, int count, size_t total) {
+    struct iovec iov[MAX_COALESCE];
+    struct iovec *next = iov;
+    Write *write = first;
+    off_t offset = first->offset;
+    size_t remaining = total;
+
+    for (int i = 0; i < count; ++i, write = write->next) {
+        iov[i].iov_base = (void *)write->data;
+        iov[i].iov_len = write->length;
+    }
+
+    while (remaining > 0) {
+        ssize_t written = pwritev(first->fd, next, count - (next - iov), offset);
+
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("pwritev");
+            return -1;
+        }
+
+        offset += written;
+        remaining -= written;
+
+        // skip past whatever a short write managed to write
+        while (written > 0 && written >= next->iov_len) {
+            written -= next->iov_len;
+            ++next;
+        }
+        if (written > 0) {
+            next->iov_base = (char *)next->iov_base + written;
+            next->iov_len -= written;
+        }
+    }
+
+    return 0;
+}
+
+
+static void *writer_thread(void *arg) {
+    Writer *writer = (Writer *)arg;
+
+    trace_thread_name("writer");
+
+    pthread_mutex_lock(&writer->lock);
+
+    while (1) {
+        while (writer->pending == NULL && !writer->stopping) {
+            pthread_cond_wait(&writer->has_work, &writer->lock);
+        }
+
+        if (writer->pending == NULL) {
+            break;
+        }
+
+        // take the first write and every write adjacent to it
+        Write *first = writer->pending, *last = first;
+        size_t total = first->length;
+        int count = 1;
+
+        while (last->next && count < MAX_COALESCE && last->next->fd == first->fd
+                && last->next->offset == last->offset + (off_t)last->length) {
+            last = last->next;
+            total += last->length;
+            ++count;
+        }
+
+        writer->pending = last->next;
+        last->next = NULL;
+
+        pthread_mutex_unlock(&writer->lock);
+
+        long start = trace_now();
+        int rc = write_run(first, count, total);
+        trace_span("write", start);
+
+        // start writeback now rather than letting dirty pages pile up
+        if (rc == 0 && writer->sync_bytes > 0 && total >= writer->sync_bytes) {
+            sync_file_range(first->fd, first->offset, total, SYNC_FILE_RANGE_WRITE);
+        }
+
+        while (first) {
+            Write *next = first->next;
+            first->callback(first->arg, rc == 0 ? (ssize_t)first->length : -1);
+            free(first);
+            first = next;
+        }
+
+        pthread_mutex_lock(&writer->lock);
+        writer->pending_bytes -= total;
+        pthread_cond_broadcast(&writer->has_space);
+    }
+
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+
+/**
+ * Create a writer and start its threads
+ * @param num_threads - The number of writer threads
+ * @param budget - The maximum number of bytes waiting to be written before
+ *                 writer_submit blocks
+ * @param sync_bytes - Writes of at least this many bytes have writeback
+ *                     started immediately, 0 to leave it to the kernel
+ * @param options - How to place the writer threads, NULL for the defaults
+ * @return writer - Pointer to the allocated writer
+ */
+Writer *writer_alloc(int num_threads, size_t budget, size_t sync_bytes, ThreadOptions *options) {
+    assert(num_threads > 0);
+
+    Writer *writer = (Writer *)malloc(sizeof(Writer));
+    if (writer == NULL) {
+        handle_error("malloc");
+    }
+
+    writer->pending = NULL;
+    writer->pending_bytes = 0;
+    writer->budget = budget;
+    writer->sync_bytes = sync_bytes;
+    writer->stopping = 0;
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->has_work, NULL);
+    pthread_cond_init(&writer->has_space, NULL);
+
+    writer->num_threads = num_threads;
+    writer->threads = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+
+    for (int i = 0; i < num_threads; ++i) {
+        thread_create(&writer->threads[i], options, writer_thread, writer);
+    }
+
+    return writer;
+}
+
+
+/**
+ * Wait for all pending writes, stop the writer threads and free the writer
+ * @param writer - Pointer to the writer to free
+ */
+void writer_free(Writer *writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->stopping = 1;
+    pthread_cond_broadcast(&writer->has_work);
+    pthread_mutex_unlock(&writer->lock);
+
+    for (int i = 0; i < writer->num_threads; ++i) {
+        int rc = pthread_join(writer->threads[i], NULL);
+        if (rc != 0) {
+            handle_error_en(rc, "pthread_join");
+        }
+    }
+
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->has_work);
+    pthread_cond_destroy(&writer->has_space);
+
+    free(writer->threads);
+    free(writer);
+}
+
+
+/**
+ * Queue a chunk to be written to a file at a given offset.
+ * Blocks while the pending bytes exceed the writer's memory budget, which
+ * applies backpressure to the caller. A chunk larger than the budget is
+ * accepted once nothing else is pending.
+ * The data must stay valid until the callback is called.
+ *
+ * @param writer - Pointer to the writer
+ * @param fd - The file descriptor to write to
+ * @param offset - Offset in the file to write the data at
+ * @param data - The data to write
+ * @param length - The number of bytes to write
+ * @param callback - Called from a writer thread after the write
+ * @param arg - Passed to the callback
+ */
+void writer_submit(Writer *writer, int fd, off_t offset, const char *data,
+        size_t length, WriteCallback callback, void *arg) {
+    Write *write = (Write *)malloc(sizeof(Write));
+    if (write == NULL) {
+        handle_error("malloc");
+    }
+
+    write->fd = fd;
+    write->offset = offset;
+    write->data = data;
+    write->length = length;
+    write->callback = callback;
+    write->arg = arg;
+
+    pthread_mutex_lock(&writer->lock);
+
+    while (writer->pending_bytes > 0 && writer->pending_bytes + length > writer->budget) {
+        pthread_cond_wait(&writer->has_space, &writer->lock);
+    }
+
+    // keep the pending list sorted so adjacent chunks end up next to each other
+    Write **link = &writer->pending;
+    while (*link && ((*link)->fd < fd || ((*link)->fd == fd && (*link)->offset < offset))) {
+        link = &(*link)->next;
+    }
+    write->next = *link;
+    *link = write;
+
+    writer->pending_bytes += length;
+    pthread_cond_signal(&writer->has_work);
+
+    pthread_mutex_unlock(&writer->lock);
+}
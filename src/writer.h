@@ -0,0 +1,64 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <sys/types.h>
+
+#include "thread.h"
+
+
+/*
+ * Writer - a pool of threads writing completed chunks to their output files.
+ * Pending writes are kept sorted by file and offset so adjacent chunks are
+ * coalesced into a single large sequential write.
+ */
+typedef struct WriterStruct Writer;
+
+
+/**
+ * Called by a writer thread once a chunk has been written.
+ * @param arg - The argument given to writer_submit
+ * @param written - Number of bytes written, or -1 if the write failed
+ */
+typedef void (*WriteCallback)(void *arg, ssize_t written);
+
+
+/**
+ * Create a writer and start its threads
+ * @param num_threads - The number of writer threads
+ * @param budget - The maximum number of bytes waiting to be written before
+ *                 writer_submit blocks
+ * @param sync_bytes - Writes of at least this many bytes have writeback
+ *                     started immediately, 0 to leave it to the kernel
+ * @param options - How to place the writer threads, NULL for the defaults
+ * @return writer - Pointer to the allocated writer
+ */
+Writer *writer_alloc(int num_threads, size_t budget, size_t sync_bytes, ThreadOptions *options);
+
+
+/**
+ * Wait for all pending writes, stop the writer threads and free the writer
+ * @param writer - Pointer to the writer to free
+ */
+void writer_free(Writer *writer);
+
+
+/**
+ * Queue a chunk to be written to a file at a given offset.
+ * Blocks while the pending bytes exceed the writer's memory budget, which
+ * applies backpressure to the caller. A chunk larger than the budget is
+ * accepted once nothing else is pending.
+ * The data must stay valid until the callback is called.
+ *
+ * @param writer - Pointer to the writer
+ * @param fd - The file descriptor to write to
+ * @param offset - Offset in the file to write the data at
+ * @param data - The data to write
+ * @param length - The number of bytes to write
+ * @param callback - Called from a writer thread after the write
+ * @param arg - Passed to the callback
+ */
+void writer_submit(Writer *writer, int fd, off_t offset, const char *data,
+        size_t length, WriteCallback callback, void *arg);
+
+
+#endif
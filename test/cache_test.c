@@ -0,0 +1,197 @@
+#define _GNU_SOURCE
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+#define BLOB_SIZE 4096
+#define PATH_SIZE 1024
+
+// Room for three blobs, so storing a fourth evicts one
+#define MAX_BYTES (3 * BLOB_SIZE)
+
+
+static char dir[] = "/tmp/cache_testXXXXXX";
+
+
+/**
+ * Write a file filled with one byte, standing in for a download
+ * @return 0 on success, -1 on failure
+ */
+static int write_file(const char *path, char fill) {
+    char data[BLOB_SIZE];
+
+    memset(data, fill, BLOB_SIZE);
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+
+    size_t written = fwrite(data, 1, BLOB_SIZE, file);
+    fclose(file);
+
+    return written == BLOB_SIZE ? 0 : -1;
+}
+
+
+/**
+ * Check a file is filled with one byte
+ * @return 1 if it is, 0 otherwise
+ */
+static int file_is(const char *path, char fill) {
+    char data[BLOB_SIZE + 1];
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+
+    size_t length = fread(data, 1, BLOB_SIZE + 1, file);
+    fclose(file);
+
+    for (size_t i = 0; i < length; ++i) {
+        if (data[i] != fill) {
+            return 0;
+        }
+    }
+
+    return length == BLOB_SIZE;
+}
+
+
+/**
+ * Store a file filled with one byte under a url, with its fill as the etag
+ * @return 0 on success, -1 on failure
+ */
+static int store(Cache *cache, const char *url, char fill) {
+    char path[PATH_SIZE];
+    Validators validators;
+
+    memset(&validators, 0, sizeof(Validators));
+    snprintf(validators.etag, VALIDATOR_SIZE, "\"%c\"", fill);
+    snprintf(path, PATH_SIZE, "%s/download", dir);
+
+    if (write_file(path, fill) == -1) {
+        return -1;
+    }
+
+    int rc = cache_store(cache, url, path, &validators);
+    unlink(path);
+    return rc;
+}
+
+
+/**
+ * Check whether a url is cached, and with the etag it was stored with
+ * @return 1 if it is, 0 otherwise
+ */
+static int cached(Cache *cache, const char *url, char fill) {
+    char etag[VALIDATOR_SIZE];
+    Validators validators;
+
+    snprintf(etag, VALIDATOR_SIZE, "\"%c\"", fill);
+
+    return cache_lookup(cache, url, &validators) == 0 && strcmp(validators.etag, etag) == 0;
+}
+
+
+static int remove_path(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    return remove(path);
+}
+
+
+int main(int argc, char **argv) {
+    char path[PATH_SIZE], cache_dir[PATH_SIZE];
+    Validators none;
+    int ok = 1;
+
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    snprintf(cache_dir, PATH_SIZE, "%s/cache", dir);
+    snprintf(path, PATH_SIZE, "%s/linked", dir);
+    memset(&none, 0, sizeof(Validators));
+
+    Cache *cache = cache_open(cache_dir, MAX_BYTES);
+    if (cache == NULL) {
+        return 1;
+    }
+
+    // nothing to revalidate with, so nothing is stored
+    write_file(path, 'x');
+    if (cache_store(cache, "localhost/x", path, &none) != -1 || cache_lookup(cache, "localhost/x", &none) != -1) {
+        fprintf(stderr, "stored a download without validators\n");
+        ok = 0;
+    }
+
+    ok &= store(cache, "localhost/a", 'a') == 0;
+    ok &= store(cache, "localhost/b", 'b') == 0;
+    ok &= store(cache, "localhost/c", 'c') == 0;
+
+    // using a makes b the least recently used, so b goes to make room for d
+    ok &= cache_link(cache, "localhost/a", path) == 0 && file_is(path, 'a');
+    ok &= store(cache, "localhost/d", 'd') == 0;
+
+    if (cached(cache, "localhost/b", 'b') || !cached(cache, "localhost/a", 'a') ||
+            !cached(cache, "localhost/c", 'c') || !cached(cache, "localhost/d", 'd')) {
+        fprintf(stderr, "evicted the wrong entry\n");
+        ok = 0;
+    }
+
+    cache_close(cache);
+
+    // the index is read back on the next run, recency included
+    cache = cache_open(cache_dir, MAX_BYTES);
+    if (cache == NULL) {
+        return 1;
+    }
+
+    if (cached(cache, "localhost/b", 'b') || !cached(cache, "localhost/a", 'a') ||
+            !cached(cache, "localhost/c", 'c') || !cached(cache, "localhost/d", 'd')) {
+        fprintf(stderr, "index not reloaded\n");
+        ok = 0;
+    }
+
+    ok &= cache_link(cache, "localhost/d", path) == 0 && file_is(path, 'd');
+    ok &= store(cache, "localhost/e", 'e') == 0;
+
+    if (cached(cache, "localhost/c", 'c') || !cached(cache, "localhost/e", 'e')) {
+        fprintf(stderr, "evicted the wrong entry after reloading\n");
+        ok = 0;
+    }
+
+    // the cache keeps its own copy, so a download edited in place after it
+    // was stored leaves the cached copy alone
+    char download[PATH_SIZE];
+    Validators validators;
+
+    memset(&validators, 0, sizeof(Validators));
+    strcpy(validators.etag, "\"f\"");
+    snprintf(download, PATH_SIZE, "%s/edited", dir);
+    write_file(download, 'f');
+    ok &= cache_store(cache, "localhost/f", download, &validators) == 0;
+
+    FILE *file = fopen(download, "r+");
+    if (file != NULL) {
+        fputc('x', file);
+        fclose(file);
+    }
+
+    if (cache_link(cache, "localhost/f", path) != 0 || !file_is(path, 'f')) {
+        fprintf(stderr, "editing a download changed its cached copy\n");
+        ok = 0;
+    }
+
+    cache_close(cache);
+    nftw(dir, remove_path, 16, FTW_DEPTH | FTW_PHYS);
+
+    printf("%d byte cache: %s\n", MAX_BYTES, ok ? "ok" : "wrong");
+    return ok ? 0 : 1;
+}
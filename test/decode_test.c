@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "decode.h"
+
+#define N 1000000
+#define BLOCK 1000
+
+typedef struct {
+    char *data;
+    size_t length;
+} Output;
+
+
+int collect(void *arg, const char *data, size_t length) {
+    Output *output = (Output*)arg;
+
+    if (output->length + length > N) {
+        return -1;
+    }
+
+    memcpy(output->data + output->length, data, length);
+    output->length += length;
+    return 0;
+}
+
+
+/*
+ * Compress the input with the given zlib window bits, then decode it
+ * in small blocks and check it comes back unchanged.
+ */
+int check(const char *encoding, int window_bits, const char *input) {
+    z_stream zs;
+    size_t bound = N + N / 100 + 1024;
+    unsigned char *compressed = malloc(bound);
+    Output output = { malloc(N), 0 };
+
+    memset(&zs, 0, sizeof(zs));
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
+    zs.next_in = (unsigned char*)input;
+    zs.avail_in = N;
+    zs.next_out = compressed;
+    zs.avail_out = bound;
+    deflate(&zs, Z_FINISH);
+    size_t compressed_length = zs.total_out;
+    deflateEnd(&zs);
+
+    Decoder *decoder = decoder_alloc(encoding, collect, &output);
+    int ok = decoder != NULL;
+
+    for (size_t i = 0; ok && i < compressed_length; i += BLOCK) {
+        size_t length = compressed_length - i < BLOCK ? compressed_length - i : BLOCK;
+        ok = decoder_write(decoder, (char*)compressed + i, length) == 0;
+    }
+
+    ok = ok && decoder_finish(decoder) == N && memcmp(output.data, input, N) == 0;
+
+    printf("%s (%lu compressed bytes): %s\n", encoding, compressed_length, ok ? "ok" : "FAILED");
+
+    if (decoder) {
+        decoder_free(decoder);
+    }
+    free(compressed);
+    free(output.data);
+    return ok;
+}
+
+
+int main(int argc, char **argv) {
+    char *input = malloc(N);
+    int ok = 1;
+
+    for (int i = 0; i < N; ++i) {
+        input[i] = "ENCE360 concurrent downloader\n"[i % 30] + (i / 30) % 3;
+    }
+
+    ok &= check("gzip", MAX_WBITS + 16, input);
+    ok &= check("deflate", MAX_WBITS, input);
+    ok &= check("deflate", -MAX_WBITS, input);
+
+    Output output = { malloc(N), 0 };
+    Decoder *truncated = decoder_alloc("gzip", collect, &output);
+    decoder_write(truncated, "\x1f\x8b\x08\x00", 4);
+    printf("truncated gzip: %s\n", decoder_finish(truncated) == -1 ? "ok" : "FAILED");
+    decoder_free(truncated);
+    free(output.data);
+
+    free(input);
+    return ok ? 0 : 1;
+}
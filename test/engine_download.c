@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "libdownloader.h"
+
+
+typedef struct {
+    DlEngine *engine;
+    char *url;
+    char *filename;
+    int status;
+} Caller;
+
+
+void downloaded(DlDownload *download, int status, void *arg) {
+    printf("callback: %s %s\n", dl_url(download), status == 0 ? "done" : "failed");
+}
+
+
+/*
+ * Each caller thread submits its own download to the shared engine and
+ * waits for it.
+ */
+void *caller_thread(void *arg) {
+    Caller *caller = (Caller *)arg;
+
+    DlDownload *download = dl_submit(caller->engine, caller->url, caller->filename,
+            NULL, downloaded, NULL);
+
+    caller->status = dl_wait(download);
+    dl_download_free(download);
+
+    return NULL;
+}
+
+
+int main(int argc, char **argv) {
+
+    if (argc < 3 || argc % 2 != 1) {
+        fprintf(stderr, "usage: ./engine_download url filename [url filename ...]\n");
+        exit(1);
+    }
+
+    int num_callers = (argc - 1) / 2;
+    Caller *callers = (Caller *)malloc(sizeof(Caller) * num_callers);
+    pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * num_callers);
+    int failed = 0;
+
+    DlConfig config;
+    dl_config_init(&config);
+    config.max_active = num_callers;
+
+    DlEngine *engine = dl_engine_create(&config);
+    if (engine == NULL) {
+        exit(1);
+    }
+
+    for (int i = 0; i < num_callers; ++i) {
+        callers[i].engine = engine;
+        callers[i].url = argv[1 + i * 2];
+        callers[i].filename = argv[2 + i * 2];
+        pthread_create(&threads[i], NULL, caller_thread, &callers[i]);
+    }
+
+    for (int i = 0; i < num_callers; ++i) {
+        pthread_join(threads[i], NULL);
+
+        printf("%s from %s\n", callers[i].status == 0 ? "downloaded" : "failed to download",
+                callers[i].url);
+        failed += callers[i].status != 0;
+    }
+
+    dl_engine_free(engine);
+
+    free(threads);
+    free(callers);
+    return failed ? 1 : 0;
+}
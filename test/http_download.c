@@ -5,16 +5,89 @@
 #include "http.h"
 
 
+/**
+ * Download a url as several ranges pipelined over one connection. Ranges a
+ * server did not answer on that connection are fetched one at a time.
+ * @return The content, or NULL on failure
+ */
+char *download_pipelined(char *url, int chunks, size_t *length) {
+    off_t chunk_size = 0, total = 0;
+    int count = http_plan(url, chunks, NULL, NULL, &chunk_size, &total);
+
+    if (total <= 0) {
+        return NULL;
+    }
+
+    char *content = malloc(total);
+    char **ranges = malloc(sizeof(char *) * count);
+    char **dests = malloc(sizeof(char *) * count);
+    size_t *lengths = malloc(sizeof(size_t) * count);
+
+    for (int i = 0; i < count; ++i) {
+        off_t start = i * chunk_size;
+        off_t end = start + chunk_size < total ? start + chunk_size : total;
+
+        ranges[i] = malloc(64);
+        snprintf(ranges[i], 64, "%lld-%lld", (long long)start, (long long)end - 1);
+        dests[i] = content + start;
+        lengths[i] = end - start;
+    }
+
+    int done = http_url_pipelined(url, (const char **)ranges, count, dests, lengths);
+    printf("pipelined %d of %d ranges from %s\n", done > 0 ? done : 0, count, url);
+
+    for (int i = done > 0 ? done : 0; i < count && content; ++i) {
+        if (http_url_into(url, ranges[i], dests[i], lengths[i]) != (ssize_t)lengths[i]) {
+            free(content);
+            content = NULL;
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        free(ranges[i]);
+    }
+    free(ranges);
+    free(dests);
+    free(lengths);
+
+    *length = total;
+    return content;
+}
+
+
 int main(int argc, char **argv) {
 
-    if (argc != 3) {
-        fprintf(stderr, "usage: ./http_download url filename\n");
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "usage: ./http_download url filename [pipelined_chunks]\n");
         exit(1);
     }
 
     char *url = argv[1];
     char *filename = argv[2];
 
+    if (argc == 4) {
+        size_t length = 0;
+        char *content = download_pipelined(url, atoi(argv[3]), &length);
+
+        if (content == NULL) {
+            printf("failed to download from %s\n", url);
+            return 0;
+        }
+
+        FILE *fp = fopen(filename, "w");
+        if (fp == NULL) {
+            fprintf(stderr, "error writing to: %s\n", filename);
+            exit(EXIT_FAILURE);
+        }
+
+        fwrite(content, 1, length, fp);
+        printf("downloaded %d bytes from %s\n", (int)length, url);
+
+        fclose(fp);
+        free(content);
+        return 0;
+    }
+
     Buffer *response = http_url(url, "");
 
 
@@ -0,0 +1,125 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lanes.h"
+
+#define NUM_LANES 8
+#define CHUNK_SIZE 4096
+#define NUM_CHUNKS 1000
+#define RETRIES 50
+
+// Every this many chunks fails the first time it is fetched
+#define FAIL_EVERY 25
+
+
+typedef struct {
+    RangeSet *remaining;
+    Lanes *lanes;
+    int always_fail;
+
+    char attempts[NUM_CHUNKS];  // Updated atomically
+    off_t written;              // Updated atomically
+    int finalized;              // Lanes told to finalize, updated atomically
+    off_t written_at_finalize;
+} Download;
+
+
+/**
+ * A lane of a direct download: fetch chunks until there are none left,
+ * then retire, finalizing if it is the last
+ */
+static void *run_lane(void *arg) {
+    Download *download = (Download *)arg;
+    off_t start = 0, end = 0;
+
+    while (range_set_carve(download->remaining, CHUNK_SIZE, &start, &end) == 0) {
+        int chunk = start / CHUNK_SIZE;
+        int attempt = __atomic_fetch_add(&download->attempts[chunk], 1, __ATOMIC_RELAXED);
+
+        if (download->always_fail || (chunk % FAIL_EVERY == 0 && attempt == 0)) {
+            lanes_fail(download->lanes, start, end, 1);
+        }
+        else {
+            __atomic_add_fetch(&download->written, end - start, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (lanes_retire(download->lanes)) {
+        download->written_at_finalize = __atomic_load_n(&download->written, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&download->finalized, 1, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Run a download across every lane
+ */
+static void run_download(Download *download, int retries, int always_fail) {
+    pthread_t threads[NUM_LANES];
+
+    download->remaining = range_set_alloc(0, (off_t)NUM_CHUNKS * CHUNK_SIZE);
+    download->lanes = lanes_alloc(download->remaining, retries);
+    download->always_fail = always_fail;
+    download->written = 0;
+    download->finalized = 0;
+    download->written_at_finalize = -1;
+
+    for (int i = 0; i < NUM_CHUNKS; ++i) {
+        download->attempts[i] = 0;
+    }
+
+    for (int i = 0; i < NUM_LANES; ++i) {
+        lanes_open(download->lanes);
+    }
+
+    for (int i = 0; i < NUM_LANES; ++i) {
+        pthread_create(&threads[i], NULL, run_lane, download);
+    }
+
+    for (int i = 0; i < NUM_LANES; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+
+int main(int argc, char **argv) {
+    Download download;
+    int ok = 1;
+
+    // failed chunks are fetched again, and only the last lane finalizes,
+    // once every chunk is in
+    run_download(&download, RETRIES, 0);
+
+    if (download.finalized != 1 || download.written_at_finalize != (off_t)NUM_CHUNKS * CHUNK_SIZE ||
+            lanes_failed(download.lanes) != 0) {
+        fprintf(stderr, "%d lanes finalized with %lld bytes written and %d chunks failed\n",
+                download.finalized, (long long)download.written_at_finalize, lanes_failed(download.lanes));
+        ok = 0;
+    }
+
+    lanes_free(download.lanes);
+    range_set_free(download.remaining);
+
+    // once the retries run out, chunks fail for good rather than being
+    // fetched forever, and the download still finalizes exactly once
+    run_download(&download, RETRIES, 1);
+
+    if (download.finalized != 1 || lanes_failed(download.lanes) != NUM_CHUNKS) {
+        fprintf(stderr, "%d lanes finalized with %d chunks failed\n",
+                download.finalized, lanes_failed(download.lanes));
+        ok = 0;
+    }
+
+    // a chunk that cannot be fetched again fails for good whatever retries are left
+    lanes_fail(download.lanes, 0, CHUNK_SIZE, 0);
+    ok &= lanes_failed(download.lanes) == NUM_CHUNKS + 1 && range_set_bytes(download.remaining) == 0;
+
+    lanes_free(download.lanes);
+    range_set_free(download.remaining);
+
+    printf("%d chunks over %d lanes: %s\n", NUM_CHUNKS, NUM_LANES, ok ? "ok" : "wrong");
+    return ok ? 0 : 1;
+}
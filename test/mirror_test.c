@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mirror.h"
+
+#define NUM_CHUNKS 40
+
+// One origin three times as fast as the other
+#define FAST_RATE 3000
+#define SLOW_RATE 1000
+
+
+/**
+ * Fetch a chunk from an origin as if it took the given time
+ * @return The origin picked
+ */
+static int fetch(MirrorSet *set, int avoid, ssize_t bytes, double seconds) {
+    int mirror = mirror_pick(set, avoid);
+
+    if (mirror != -1) {
+        mirror_done(set, mirror, bytes, seconds);
+    }
+
+    return mirror;
+}
+
+
+int main(int argc, char **argv) {
+    char *urls[] = { "fast.example/file", "slow.example/file", "new.example/file" };
+    int picked[3] = { 0 }, ok = 1, chunks = 0;
+    size_t bytes = 0;
+    double rate = 0;
+
+    MirrorSet *set = mirror_set_alloc(urls, 2);
+
+    // measure each origin once
+    ok &= fetch(set, -1, FAST_RATE, 1.0) == 0;
+    ok &= fetch(set, 0, SLOW_RATE, 1.0) == 1;
+
+    // chunks in flight go to each origin in proportion to its throughput
+    for (int i = 0; i < NUM_CHUNKS; ++i) {
+        ++picked[mirror_pick(set, -1)];
+    }
+
+    if (abs(picked[0] - NUM_CHUNKS * 3 / 4) > 1 || abs(picked[1] - NUM_CHUNKS / 4) > 1) {
+        fprintf(stderr, "picked %d fast and %d slow\n", picked[0], picked[1]);
+        ok = 0;
+    }
+
+    for (int i = 0; i < picked[0]; ++i) {
+        mirror_done(set, 0, FAST_RATE, 1.0);
+    }
+    for (int i = 0; i < picked[1]; ++i) {
+        mirror_done(set, 1, SLOW_RATE, 1.0);
+    }
+
+    // an origin that just failed is avoided while another is healthy
+    ok &= mirror_pick(set, 0) == 1;
+    mirror_done(set, 1, SLOW_RATE, 1.0);
+
+    // a success in between forgives earlier failures
+    ok &= fetch(set, 0, -1, 1.0) == 1;
+    ok &= fetch(set, 0, -1, 1.0) == 1;
+    ok &= fetch(set, 0, SLOW_RATE, 1.0) == 1;
+    ok &= mirror_stats(set, 1, &chunks, &bytes, &rate) == 0;
+
+    // three failures in a row drop it, after which only the other is used
+    for (int i = 0; i < 3; ++i) {
+        ok &= fetch(set, 0, -1, 1.0) == 1;
+    }
+
+    ok &= mirror_stats(set, 1, &chunks, &bytes, &rate) == 1;
+    ok &= chunks == picked[1] + 3 && bytes == (size_t)chunks * SLOW_RATE;
+
+    for (int i = 0; i < NUM_CHUNKS; ++i) {
+        if (fetch(set, 0, FAST_RATE, 1.0) != 0) {
+            fprintf(stderr, "picked a dropped mirror\n");
+            ok = 0;
+            break;
+        }
+    }
+
+    // with every origin dropped there is nothing left to pick
+    for (int i = 0; i < 3; ++i) {
+        fetch(set, -1, -1, 1.0);
+    }
+    ok &= mirror_pick(set, -1) == -1;
+
+    mirror_set_free(set);
+
+    // an origin not measured yet is assumed to be as fast as the fastest
+    set = mirror_set_alloc(urls, 3);
+
+    ok &= fetch(set, -1, FAST_RATE, 1.0) == 0;
+    ok &= fetch(set, 0, SLOW_RATE, 1.0) == 1;
+
+    picked[0] = picked[1] = picked[2] = 0;
+    for (int i = 0; i < NUM_CHUNKS; ++i) {
+        ++picked[mirror_pick(set, -1)];
+    }
+
+    if (abs(picked[2] - picked[0]) > 1) {
+        fprintf(stderr, "picked %d fast and %d unmeasured\n", picked[0], picked[2]);
+        ok = 0;
+    }
+
+    mirror_set_free(set);
+
+    printf("%d chunks, mirrors: %s\n", NUM_CHUNKS, ok ? "ok" : "wrong");
+    return ok ? 0 : 1;
+}
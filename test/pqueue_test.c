@@ -0,0 +1,101 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "pqueue.h"
+
+#define NUM_THREADS 16
+#define N 1000000
+#define M 1000
+
+typedef struct {
+    int value;
+} Task;
+
+
+void *doSum(void *arg) {
+    int sum = 0;
+    PriorityQueue *queue = (PriorityQueue*)arg;
+
+    Task *task = (Task*)pqueue_get(queue);
+    while (task) {
+        sum += task->value;
+        free(task);
+
+        task = (Task*)pqueue_get(queue);
+    }
+
+    pthread_exit((void*)(intptr_t)sum);
+}
+
+
+
+int main(int argc, char **argv) {
+
+    int i, sum;
+
+    pthread_t thread[NUM_THREADS];
+    PriorityQueue *queue = pqueue_alloc(NUM_THREADS);
+
+
+    for (i = 0; i < NUM_THREADS; ++i) {
+        pthread_create(&thread[i], NULL, doSum, queue);
+    }
+
+    int expected = 0;
+    for (i = 0; i < N; ++i) {
+        Task *task = (Task*)malloc(sizeof(Task));
+        task->value = i;
+
+        pqueue_put(queue, task, i % 7);
+        expected += i;
+    }
+
+
+    for (i = 0; i < NUM_THREADS; ++i) {
+        pqueue_put(queue, NULL, LONG_MAX);
+    }
+
+    intptr_t value;
+    sum = 0;
+    for (i = 0; i < NUM_THREADS; ++i) {
+        pthread_join(thread[i], (void**)&value);
+        sum += value;
+    }
+
+    pqueue_free(queue);
+
+    printf("total sum: %d, expected sum: %d\n", (int)sum, expected);
+
+
+    // items come out by key, and in the order they were put for equal keys
+    int ordered = 1, last_key = -1, last_value = -1;
+    queue = pqueue_alloc(0);
+
+    for (i = 0; i < M; ++i) {
+        Task *task = (Task*)malloc(sizeof(Task));
+        task->value = i;
+
+        pqueue_put(queue, task, (i * 37) % 10);
+    }
+
+    for (i = 0; i < M; ++i) {
+        Task *task = (Task*)pqueue_get(queue);
+        int key = (task->value * 37) % 10;
+
+        if (key < last_key || (key == last_key && task->value < last_value)) {
+            ordered = 0;
+        }
+
+        last_key = key;
+        last_value = task->value;
+        free(task);
+    }
+
+    pqueue_free(queue);
+
+    printf("ordered: %s\n", ordered ? "yes" : "no");
+    return ordered ? 0 : 1;
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ranges.h"
+
+// Larger than 4 GiB, so offsets overflow anything narrower than 64 bits
+#define SIZE ((off_t)5 << 30)
+#define CHUNK ((off_t)64 << 20)
+
+
+int main(int argc, char **argv) {
+    RangeSet *set = range_set_alloc(0, SIZE);
+    off_t start = 0, end = 0, carved = 0;
+    int ok = 1, chunks = 0;
+
+    // carve every chunk, putting every third one in the first half back once
+    while (range_set_carve(set, CHUNK, &start, &end) == 0) {
+        if (start % CHUNK != 0 || end - start > CHUNK) {
+            ok = 0;
+        }
+
+        if (chunks++ % 3 == 0 && start < SIZE / 2) {
+            range_set_add(set, start, end);
+            continue;
+        }
+
+        carved += end - start;
+    }
+
+    if (carved != SIZE) {
+        ok = 0;
+    }
+
+    // ranges touching each other are merged
+    range_set_add(set, 10, 20);
+    range_set_add(set, 30, 40);
+    range_set_add(set, 20, 30);
+    range_set_add(set, 0, 5);
+
+    if (range_set_bytes(set) != 35) {
+        ok = 0;
+    }
+
+    if (range_set_carve(set, 100, &start, &end) != 0 || start != 0 || end != 5) {
+        ok = 0;
+    }
+
+    if (range_set_carve(set, 100, &start, &end) != 0 || start != 10 || end != 40) {
+        ok = 0;
+    }
+
+    if (range_set_carve(set, 100, &start, &end) != -1) {
+        ok = 0;
+    }
+
+    range_set_free(set);
+
+    printf("carved %d chunks of %lld bytes, ranges: %s\n", chunks, (long long)SIZE, ok ? "ok" : "wrong");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+// Enough spans to wrap the ring around
+#define NUM_SPANS (TRACE_RING_SIZE + 100)
+
+#define LABEL_PREFIX "\"label\":\"span "
+
+
+/**
+ * Read a whole file into memory
+ * @return The contents, null terminated, or NULL on failure
+ */
+static char *read_file(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *data = (char *)malloc(length + 1);
+    data[fread(data, 1, length, file)] = '\0';
+    fclose(file);
+
+    return data;
+}
+
+
+int main(int argc, char **argv) {
+    char path[] = "/tmp/trace_testXXXXXX";
+    int ok = 1, spans = 0, expected = NUM_SPANS - TRACE_RING_SIZE + 1;
+
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    if (trace_enable() == -1) {
+        fprintf(stderr, "tracing compiled out\n");
+        unlink(path);
+        return 1;
+    }
+
+    trace_thread_name("test");
+
+    for (int i = 0; i < NUM_SPANS; ++i) {
+        long start = trace_now();
+
+        trace_label("span %d", i);
+        trace_span("span", start);
+    }
+
+    // a label is any text, e.g. a url, and must come out as a valid string
+    long start = trace_now();
+    trace_label("a\"b\\c\nd\te");
+    trace_span("escaped", start);
+
+    ok &= trace_dump(path) == 0;
+
+    char *json = read_file(path);
+    unlink(path);
+
+    if (json == NULL) {
+        return 1;
+    }
+
+    // only the newest spans are kept, oldest first
+    for (char *label = strstr(json, LABEL_PREFIX); label != NULL; label = strstr(label + 1, LABEL_PREFIX)) {
+        int span = atoi(label + strlen(LABEL_PREFIX));
+
+        if (span != expected) {
+            fprintf(stderr, "span %d where span %d was expected\n", span, expected);
+            ok = 0;
+            break;
+        }
+
+        ++expected;
+        ++spans;
+    }
+
+    ok &= spans == TRACE_RING_SIZE - 1 && expected == NUM_SPANS;
+    ok &= strstr(json, "\"label\":\"a\\\"b\\\\c\\u000ad\\u0009e\"") != NULL;
+    ok &= strstr(json, "\"args\":{\"name\":\"test 1\"}") != NULL;
+
+    // the events are wrapped in a complete JSON object
+    ok &= strncmp(json, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 39) == 0 &&
+            strcmp(json + strlen(json) - 4, "\n]}\n") == 0;
+
+    free(json);
+
+    printf("%d spans, trace ring: %s\n", NUM_SPANS, ok ? "ok" : "wrong");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "url.h"
+
+#define URL_SIZE 1024
+
+// More urls than the table starts with buckets for, so it has to grow
+#define NUM_URLS 500
+
+
+static int freed = 0;
+
+static void count_free(void *value) {
+    ++freed;
+}
+
+
+/**
+ * Check a url normalizes to what is expected
+ * @return 1 if it does, 0 otherwise
+ */
+static int normalizes_to(const char *url, const char *expected) {
+    char normalized[URL_SIZE];
+
+    url_normalize(url, normalized, URL_SIZE);
+
+    if (strcmp(normalized, expected) != 0) {
+        fprintf(stderr, "%s normalized to %s, not %s\n", url, normalized, expected);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+int main(int argc, char **argv) {
+    char url[URL_SIZE];
+    int ok = 1, values[NUM_URLS];
+
+    // the scheme, default port, case of the host and a trailing slash do not matter
+    ok &= normalizes_to("WWW.Canterbury.ac.nz:80/index.html/", "www.canterbury.ac.nz/index.html");
+    ok &= normalizes_to("http://LOCALHOST/big.bin", "localhost/big.bin");
+    ok &= normalizes_to("HTTP://localhost:80/big.bin/", "localhost/big.bin");
+
+    // the path is case sensitive, and other ports are other servers
+    ok &= normalizes_to("localhost/Big.bin", "localhost/Big.bin");
+    ok &= normalizes_to("localhost:8080/big.bin", "localhost:8080/big.bin");
+    ok &= normalizes_to("localhost:801/big.bin", "localhost:801/big.bin");
+
+    UrlTable *table = url_table_alloc(count_free);
+
+    for (int i = 0; i < NUM_URLS; ++i) {
+        snprintf(url, URL_SIZE, "host%d.example/file%d", i % 7, i);
+        url_table_put(table, url, &values[i]);
+    }
+
+    // equivalent urls share an entry
+    for (int i = 0; i < NUM_URLS; ++i) {
+        snprintf(url, URL_SIZE, "http://HOST%d.example:80/file%d/", i % 7, i);
+
+        if (url_table_get(table, url) != &values[i]) {
+            fprintf(stderr, "%s not found\n", url);
+            ok = 0;
+        }
+    }
+
+    // different urls stay distinct
+    if (url_table_get(table, "host0.example/File0") != NULL ||
+            url_table_get(table, "host0.example:8080/file0") != NULL ||
+            url_table_get(table, "host1.example/file0") != NULL) {
+        fprintf(stderr, "different urls share an entry\n");
+        ok = 0;
+    }
+
+    // replacing a value frees the old one, and freeing the table the rest
+    url_table_put(table, "HOST0.example/file0", &values[1]);
+
+    if (freed != 1 || url_table_get(table, "host0.example/file0") != &values[1]) {
+        ok = 0;
+    }
+
+    url_table_free(table);
+
+    if (freed != NUM_URLS + 1) {
+        fprintf(stderr, "freed %d values, not %d\n", freed, NUM_URLS + 1);
+        ok = 0;
+    }
+
+    printf("%d urls, url table: %s\n", NUM_URLS, ok ? "ok" : "wrong");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "writer.h"
+
+#define CHUNK_SIZE 4096
+#define NUM_CHUNKS 16
+
+// Room for the stalled write and two more chunks
+#define BUDGET (3 * CHUNK_SIZE)
+
+
+static char data[NUM_CHUNKS][CHUNK_SIZE];
+
+static int fd;
+static int ok = 1;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static int stalled = 0, released = 0;
+static int written = 0, submitted = 0, run_checked = 0;
+
+
+/**
+ * Check the chunks from first up to last are all in the file
+ * @return 1 if they are, 0 otherwise
+ */
+static int chunks_written(int first, int last) {
+    char buffer[CHUNK_SIZE];
+
+    for (int i = first; i <= last; ++i) {
+        if (pread(fd, buffer, CHUNK_SIZE, (off_t)i * CHUNK_SIZE) != CHUNK_SIZE ||
+                memcmp(buffer, data[i], CHUNK_SIZE) != 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+/**
+ * Holds up the writer thread until released, so writes pile up behind it
+ */
+static void stall_written(void *arg, ssize_t length) {
+    pthread_mutex_lock(&lock);
+    stalled = 1;
+    pthread_cond_broadcast(&changed);
+
+    while (!released) {
+        pthread_cond_wait(&changed, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+
+static void chunk_written(void *arg, ssize_t length) {
+    int chunk = (int)(intptr_t)arg;
+
+    if (length != CHUNK_SIZE) {
+        fprintf(stderr, "chunk %d: wrote %zd bytes\n", chunk, length);
+        ok = 0;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    // the chunks queued behind the stall are adjacent, so they go in one
+    // write and are all in the file by the time the first callback runs
+    if (!run_checked) {
+        run_checked = 1;
+        if (!chunks_written(1, NUM_CHUNKS - 1)) {
+            fprintf(stderr, "adjacent chunks were not written together\n");
+            ok = 0;
+        }
+    }
+
+    ++written;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+}
+
+
+static void wait_stalled(void) {
+    pthread_mutex_lock(&lock);
+    while (!stalled) {
+        pthread_cond_wait(&changed, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+
+static void release(void) {
+    pthread_mutex_lock(&lock);
+    released = 1;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+}
+
+
+static void *submit_chunks(void *arg) {
+    Writer *writer = (Writer *)arg;
+
+    // out of order, the writer has to sort them back together
+    for (int i = NUM_CHUNKS - 1; i >= 1; --i) {
+        writer_submit(writer, fd, (off_t)i * CHUNK_SIZE, data[i], CHUNK_SIZE,
+                chunk_written, (void *)(intptr_t)i);
+
+        pthread_mutex_lock(&lock);
+        ++submitted;
+        pthread_mutex_unlock(&lock);
+    }
+
+    return NULL;
+}
+
+
+int main(int argc, char **argv) {
+    char path[] = "/tmp/writer_testXXXXXX";
+    pthread_t submitter;
+
+    fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return 1;
+    }
+    unlink(path);
+
+    for (int i = 0; i < NUM_CHUNKS; ++i) {
+        memset(data[i], 'a' + i, CHUNK_SIZE);
+    }
+
+    // coalescing: one thread, stalled on chunk 0 while the rest queue up
+    Writer *writer = writer_alloc(1, NUM_CHUNKS * CHUNK_SIZE, 0, NULL);
+
+    writer_submit(writer, fd, 0, data[0], CHUNK_SIZE, stall_written, NULL);
+    wait_stalled();
+
+    submit_chunks(writer);
+    release();
+    writer_free(writer);
+
+    if (written != NUM_CHUNKS - 1 || !chunks_written(0, NUM_CHUNKS - 1)) {
+        ok = 0;
+    }
+
+    // budget: the stalled chunk and two more fit, the next submit blocks
+    stalled = released = written = submitted = 0;
+    run_checked = 1;
+    if (ftruncate(fd, 0) == -1) {
+        perror("ftruncate");
+        return 1;
+    }
+
+    writer = writer_alloc(1, BUDGET, 0, NULL);
+
+    writer_submit(writer, fd, 0, data[0], CHUNK_SIZE, stall_written, NULL);
+    wait_stalled();
+
+    pthread_create(&submitter, NULL, submit_chunks, writer);
+    usleep(100000);
+
+    pthread_mutex_lock(&lock);
+    if (submitted != BUDGET / CHUNK_SIZE - 1) {
+        fprintf(stderr, "submitted %d chunks over a budget of %d\n", submitted, BUDGET / CHUNK_SIZE - 1);
+        ok = 0;
+    }
+    pthread_mutex_unlock(&lock);
+
+    release();
+    pthread_join(submitter, NULL);
+    writer_free(writer);
+
+    if (written != NUM_CHUNKS - 1 || !chunks_written(0, NUM_CHUNKS - 1)) {
+        ok = 0;
+    }
+
+    close(fd);
+
+    printf("%d chunks, writer: %s\n", NUM_CHUNKS, ok ? "ok" : "wrong");
+    return ok ? 0 : 1;
+}